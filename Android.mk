@@ -27,12 +27,16 @@ freedreno_drivers := freedreno
 intel_drivers := i915 i965 i915g ilo
 radeon_drivers := r300g r600g
 nouveau_drivers := nouveau
+dumb_drivers := vkms
+vgem_drivers := vgem
 
 valid_drivers := \
 	$(freedreno_drivers) \
 	$(intel_drivers) \
 	$(radeon_drivers) \
-	$(nouveau_drivers)
+	$(nouveau_drivers) \
+	$(dumb_drivers) \
+	$(vgem_drivers)
 
 # Assume other driver names are pipe drivers
 ifneq ($(filter-out $(valid_drivers), $(DRM_GPU_DRIVERS)),)
@@ -62,6 +66,7 @@ LOCAL_SHARED_LIBRARIES := \
 	liblog \
 	libcutils \
 	libhardware_legacy \
+	libsync \
 
 ifneq ($(filter $(freedreno_drivers), $(DRM_GPU_DRIVERS)),)
 LOCAL_SRC_FILES += gralloc_drm_freedreno.c
@@ -87,6 +92,19 @@ LOCAL_CFLAGS += -DENABLE_NOUVEAU
 LOCAL_SHARED_LIBRARIES += libdrm_nouveau
 endif
 
+# vgem is driven by the dumb driver as well
+ifneq ($(filter $(dumb_drivers) $(vgem_drivers), $(DRM_GPU_DRIVERS)),)
+LOCAL_SRC_FILES += gralloc_drm_dumb.c
+endif
+
+ifneq ($(filter $(dumb_drivers), $(DRM_GPU_DRIVERS)),)
+LOCAL_CFLAGS += -DENABLE_DUMB
+endif
+
+ifneq ($(filter $(vgem_drivers), $(DRM_GPU_DRIVERS)),)
+LOCAL_CFLAGS += -DENABLE_VGEM
+endif
+
 ifneq ($(filter pipe, $(DRM_GPU_DRIVERS)),)
 LOCAL_SRC_FILES += gralloc_drm_pipe.c
 LOCAL_CFLAGS += -DENABLE_PIPE -DHAVE_FUNC_ATTRIBUTE_UNUSED
@@ -123,4 +141,77 @@ LOCAL_VENDOR_MODULE := true
 LOCAL_CFLAGS := -std=c11 -Wno-unused-parameter
 include $(BUILD_SHARED_LIBRARY)
 
+
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES := \
+	tests/gralloc_drm_soak.c \
+
+LOCAL_SHARED_LIBRARIES := \
+	libhardware \
+	libcutils \
+	liblog \
+
+LOCAL_C_INCLUDES := $(LOCAL_PATH)
+
+LOCAL_MODULE := gralloc_drm_soak
+LOCAL_MODULE_TAGS := tests
+LOCAL_VENDOR_MODULE := true
+LOCAL_CFLAGS := -std=c11 -Wno-unused-parameter
+include $(BUILD_EXECUTABLE)
+
+
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES := \
+	tests/gralloc_drm_present_bench.c \
+
+LOCAL_SHARED_LIBRARIES := \
+	libhardware \
+	libcutils \
+	liblog \
+
+LOCAL_C_INCLUDES := $(LOCAL_PATH)
+
+LOCAL_MODULE := gralloc_drm_present_bench
+LOCAL_MODULE_TAGS := tests
+LOCAL_VENDOR_MODULE := true
+LOCAL_CFLAGS := -std=c11 -Wno-unused-parameter
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES := \
+	tests/gralloc_drm_map_bench.c \
+
+LOCAL_SHARED_LIBRARIES := \
+	libdrm \
+	libhardware \
+	libcutils \
+	liblog \
+
+LOCAL_C_INCLUDES := $(LOCAL_PATH)
+
+LOCAL_MODULE := gralloc_drm_map_bench
+LOCAL_MODULE_TAGS := tests
+LOCAL_VENDOR_MODULE := true
+LOCAL_CFLAGS := -std=c11 -Wno-unused-parameter
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES := \
+	tests/gralloc_drm_sample_bench.c \
+
+LOCAL_SHARED_LIBRARIES := \
+	libEGL \
+	libGLESv2 \
+	libhardware \
+	libcutils \
+	liblog \
+
+LOCAL_C_INCLUDES := $(LOCAL_PATH)
+
+LOCAL_MODULE := gralloc_drm_sample_bench
+LOCAL_MODULE_TAGS := tests
+LOCAL_VENDOR_MODULE := true
+LOCAL_CFLAGS := -std=c11 -Wno-unused-parameter
+include $(BUILD_EXECUTABLE)
+
 endif # DRM_GPU_DRIVERS
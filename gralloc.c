@@ -98,6 +98,342 @@ static int drm_mod_perform(const struct gralloc_module_t *mod, int op, ...)
 			err = 0;
 		}
 		break;
+	case GRALLOC_MODULE_PERFORM_GET_ALLOC_STATS:
+		{
+			struct gralloc_drm_alloc_stats *stats =
+				va_arg(args, struct gralloc_drm_alloc_stats *);
+
+			pthread_mutex_lock(&gralloc_lock);
+			gralloc_drm_get_alloc_stats(dmod->drm, stats);
+			pthread_mutex_unlock(&gralloc_lock);
+			err = 0;
+		}
+		break;
+	case GRALLOC_MODULE_PERFORM_GET_BUFFER_ALLOC_INFO:
+		{
+			buffer_handle_t handle = va_arg(args, buffer_handle_t);
+			uint64_t *requested = va_arg(args, uint64_t *);
+			uint64_t *allocated = va_arg(args, uint64_t *);
+			struct gralloc_drm_bo_t *bo;
+
+			pthread_mutex_lock(&gralloc_lock);
+			bo = gralloc_drm_bo_from_handle(handle);
+			if (bo) {
+				gralloc_drm_bo_get_alloc_info(bo,
+						requested, allocated);
+				err = 0;
+			}
+			else {
+				err = -EINVAL;
+			}
+			pthread_mutex_unlock(&gralloc_lock);
+		}
+		break;
+	case GRALLOC_MODULE_PERFORM_GET_KMS_CALIBRATION:
+		{
+			struct gralloc_drm_kms_calibration *cal =
+				va_arg(args, struct gralloc_drm_kms_calibration *);
+
+			pthread_mutex_lock(&dmod->mutex);
+			if (gralloc_drm_is_kms_initialized(dmod->drm)) {
+				gralloc_drm_get_kms_calibration(dmod->drm, cal);
+				err = 0;
+			}
+			else {
+				err = -ENODEV;
+			}
+			pthread_mutex_unlock(&dmod->mutex);
+		}
+		break;
+	case GRALLOC_MODULE_PERFORM_GET_DISPLAY_BANDWIDTH:
+		{
+			struct gralloc_drm_bandwidth *bw =
+				va_arg(args, struct gralloc_drm_bandwidth *);
+			int reset = va_arg(args, int);
+
+			pthread_mutex_lock(&dmod->mutex);
+			if (gralloc_drm_is_kms_initialized(dmod->drm)) {
+				gralloc_drm_get_bandwidth(dmod->drm, bw, reset);
+				err = 0;
+			}
+			else {
+				err = -ENODEV;
+			}
+			pthread_mutex_unlock(&dmod->mutex);
+		}
+		break;
+	case GRALLOC_MODULE_PERFORM_GET_LOCK_STATS:
+		{
+			struct gralloc_drm_lock_stats *stats =
+				va_arg(args, struct gralloc_drm_lock_stats *);
+
+			gralloc_drm_get_lock_stats(dmod->drm, stats);
+			err = 0;
+		}
+		break;
+	case GRALLOC_MODULE_PERFORM_SET_LOCK_WATCHDOG:
+		{
+			uint32_t ms = va_arg(args, uint32_t);
+
+			err = gralloc_drm_set_lock_watchdog(dmod->drm, ms);
+		}
+		break;
+	case GRALLOC_MODULE_PERFORM_GET_BUFFER_LOCK_INFO:
+		{
+			buffer_handle_t handle = va_arg(args, buffer_handle_t);
+			int *tid = va_arg(args, int *);
+			uint64_t *held_us = va_arg(args, uint64_t *);
+			struct gralloc_drm_bo_t *bo;
+
+			pthread_mutex_lock(&gralloc_lock);
+			bo = gralloc_drm_bo_from_handle(handle);
+			if (bo) {
+				gralloc_drm_bo_get_lock_info(bo, tid, held_us);
+				err = 0;
+			}
+			else {
+				err = -EINVAL;
+			}
+			pthread_mutex_unlock(&gralloc_lock);
+		}
+		break;
+	case GRALLOC_MODULE_PERFORM_GET_RESOURCE_STATS:
+		{
+			struct gralloc_drm_resource_stats *stats =
+				va_arg(args, struct gralloc_drm_resource_stats *);
+			int reset = va_arg(args, int);
+
+			gralloc_drm_get_resource_stats(dmod->drm, stats, reset);
+			err = 0;
+		}
+		break;
+	case GRALLOC_MODULE_PERFORM_GET_CRTC_CRC:
+		{
+			uint32_t *frame = va_arg(args, uint32_t *);
+			uint32_t *crcs = va_arg(args, uint32_t *);
+			int count = va_arg(args, int);
+
+			pthread_mutex_lock(&dmod->mutex);
+			if (gralloc_drm_is_kms_initialized(dmod->drm))
+				err = gralloc_drm_get_crtc_crc(dmod->drm,
+						frame, crcs, count);
+			else
+				err = -ENODEV;
+			pthread_mutex_unlock(&dmod->mutex);
+		}
+		break;
+	case GRALLOC_MODULE_PERFORM_GET_BUFFER_ID:
+		{
+			buffer_handle_t handle = va_arg(args, buffer_handle_t);
+			uint64_t *id = va_arg(args, uint64_t *);
+			int *pid = va_arg(args, int *);
+			struct gralloc_drm_handle_t *drm_handle =
+				gralloc_drm_handle(handle);
+
+			if (drm_handle) {
+				*id = drm_handle->id;
+				*pid = drm_handle->id_pid;
+				err = 0;
+			}
+			else {
+				err = -EINVAL;
+			}
+		}
+		break;
+	case GRALLOC_MODULE_PERFORM_GET_BUFFER_GENERATION:
+	case GRALLOC_MODULE_PERFORM_BUMP_BUFFER_GENERATION:
+		{
+			buffer_handle_t handle = va_arg(args, buffer_handle_t);
+			struct gralloc_drm_bo_t *bo;
+
+			pthread_mutex_lock(&gralloc_lock);
+			bo = gralloc_drm_bo_from_handle(handle);
+			if (!bo) {
+				err = -EINVAL;
+			}
+			else if (op == GRALLOC_MODULE_PERFORM_GET_BUFFER_GENERATION) {
+				uint32_t *generation = va_arg(args, uint32_t *);
+
+				*generation = gralloc_drm_bo_get_generation(bo);
+				err = 0;
+			}
+			else {
+				gralloc_drm_bo_bump_generation(bo);
+				err = 0;
+			}
+			pthread_mutex_unlock(&gralloc_lock);
+		}
+		break;
+	case GRALLOC_MODULE_PERFORM_GET_BUFFER_METADATA:
+	case GRALLOC_MODULE_PERFORM_SET_BUFFER_METADATA:
+		{
+			buffer_handle_t handle = va_arg(args, buffer_handle_t);
+			int type = va_arg(args, int);
+			void *data = va_arg(args, void *);
+			size_t size = va_arg(args, size_t);
+			struct gralloc_drm_bo_t *bo;
+
+			pthread_mutex_lock(&gralloc_lock);
+			bo = gralloc_drm_bo_from_handle(handle);
+			if (!bo)
+				err = -EINVAL;
+			else if (op == GRALLOC_MODULE_PERFORM_GET_BUFFER_METADATA)
+				err = gralloc_drm_bo_get_metadata(bo,
+						type, data, size);
+			else
+				err = gralloc_drm_bo_set_metadata(bo,
+						type, data, size);
+			pthread_mutex_unlock(&gralloc_lock);
+		}
+		break;
+	case GRALLOC_MODULE_PERFORM_GET_QUOTA_STATS:
+		{
+			struct gralloc_drm_quota_stats *stats =
+				va_arg(args, struct gralloc_drm_quota_stats *);
+
+			gralloc_drm_get_quota_stats(dmod->drm, stats);
+			err = 0;
+		}
+		break;
+	case GRALLOC_MODULE_PERFORM_GET_PRESENT_FENCE:
+		{
+			int *fd = va_arg(args, int *);
+
+			*fd = gralloc_drm_get_present_fence(dmod->drm);
+			err = 0;
+		}
+		break;
+	case GRALLOC_MODULE_PERFORM_SET_PRESENT_ACQUIRE_FENCE:
+		{
+			int fd = va_arg(args, int);
+
+			gralloc_drm_set_present_acquire_fence(dmod->drm, fd);
+			err = 0;
+		}
+		break;
+	case GRALLOC_MODULE_PERFORM_SET_ALLOC_CLIENT:
+		{
+			int pid = va_arg(args, int);
+
+			gralloc_drm_set_alloc_client(pid);
+			err = 0;
+		}
+		break;
+	case GRALLOC_MODULE_PERFORM_GET_PIPE_SCREEN:
+		{
+			void **screen = va_arg(args, void **);
+
+			err = gralloc_drm_get_pipe_screen(dmod->drm, screen);
+		}
+		break;
+	case GRALLOC_MODULE_PERFORM_ALLOC_CONSTRAINED:
+		{
+			int w = va_arg(args, int);
+			int h = va_arg(args, int);
+			int format = va_arg(args, int);
+			int usage = va_arg(args, int);
+			const struct gralloc_drm_constraints *list =
+				va_arg(args, const struct gralloc_drm_constraints *);
+			int count = va_arg(args, int);
+			buffer_handle_t *handle = va_arg(args, buffer_handle_t *);
+			int *stride = va_arg(args, int *);
+			struct gralloc_drm_constraints merged;
+			struct gralloc_drm_bo_t *bo;
+			int bpp = gralloc_drm_get_bpp(format);
+
+			/* fail before allocating when they conflict */
+			err = gralloc_drm_merge_constraints(list, count, &merged);
+			if (err || !bpp) {
+				err = -EINVAL;
+				break;
+			}
+
+			pthread_mutex_lock(&gralloc_lock);
+			bo = gralloc_drm_bo_create_constrained(dmod->drm,
+					w, h, format, usage, &merged);
+			if (!bo) {
+				err = (errno == EDQUOT) ? -EDQUOT : -ENOMEM;
+			}
+			else if (gralloc_drm_bo_need_fb(bo) &&
+				 (err = gralloc_drm_bo_add_fb(bo))) {
+				ALOGE("failed to add fb");
+				gralloc_drm_bo_decref(bo);
+			}
+			else {
+				*handle = gralloc_drm_bo_get_handle(bo, stride);
+				/* in pixels */
+				*stride /= bpp;
+			}
+			pthread_mutex_unlock(&gralloc_lock);
+		}
+		break;
+	case GRALLOC_MODULE_PERFORM_ALLOC_VIDEO_POOL:
+		{
+			int w = va_arg(args, int);
+			int h = va_arg(args, int);
+			int format = va_arg(args, int);
+			int usage = va_arg(args, int);
+			int count = va_arg(args, int);
+			buffer_handle_t *handles = va_arg(args, buffer_handle_t *);
+			int *stride = va_arg(args, int *);
+			struct gralloc_drm_bo_t **bos;
+			int i;
+
+			if (count <= 0) {
+				err = -EINVAL;
+				break;
+			}
+
+			bos = calloc(count, sizeof(*bos));
+			if (!bos) {
+				err = -ENOMEM;
+				break;
+			}
+
+			pthread_mutex_lock(&dmod->mutex);
+			if (gralloc_drm_is_kms_initialized(dmod->drm)) {
+				pthread_mutex_lock(&gralloc_lock);
+				err = gralloc_drm_alloc_video_pool(dmod->drm,
+						w, h, format, usage, count, bos);
+				for (i = 0; !err && i < count; i++)
+					handles[i] = gralloc_drm_bo_get_handle(bos[i],
+							stride);
+				pthread_mutex_unlock(&gralloc_lock);
+			}
+			else {
+				err = -ENODEV;
+			}
+			pthread_mutex_unlock(&dmod->mutex);
+
+			/* in pixels */
+			if (!err)
+				*stride /= gralloc_drm_get_bpp(format);
+
+			free(bos);
+		}
+		break;
+	case GRALLOC_MODULE_PERFORM_ATTACH_FENCE:
+		{
+			buffer_handle_t handle = va_arg(args, buffer_handle_t);
+			int write = va_arg(args, int);
+			uint32_t *fence = va_arg(args, uint32_t *);
+			struct gralloc_drm_bo_t *bo;
+
+			pthread_mutex_lock(&gralloc_lock);
+			bo = gralloc_drm_bo_from_handle(handle);
+			if (bo)
+				err = gralloc_drm_bo_attach_fence(bo, write, fence);
+			else
+				err = -EINVAL;
+			pthread_mutex_unlock(&gralloc_lock);
+		}
+		break;
+	case GRALLOC_MODULE_PERFORM_SIGNAL_FENCE:
+		{
+			uint32_t fence = va_arg(args, uint32_t);
+			err = gralloc_drm_signal_fence(dmod->drm, fence);
+		}
+		break;
 	default:
 		err = -EINVAL;
 		break;
@@ -165,21 +501,28 @@ static int drm_mod_lock_ycbcr(const gralloc_module_t *mod, buffer_handle_t bhand
 	void *ptr;
 	int err;
 
+	pthread_mutex_lock(&gralloc_lock);
+
 	bo = gralloc_drm_bo_from_handle(bhandle);
-	if (!bo)
-		return -EINVAL;
+	if (!bo) {
+		err = -EINVAL;
+		goto unlock;
+	}
 	handle = bo->handle;
 
 	switch(handle->format) {
 	case HAL_PIXEL_FORMAT_YCbCr_420_888:
+	case HAL_PIXEL_FORMAT_DRM_P010:
+	case HAL_PIXEL_FORMAT_DRM_P016:
 		break;
 	default:
-		return -EINVAL;
+		err = -EINVAL;
+		goto unlock;
 	}
 
 	err = gralloc_drm_bo_lock(bo, usage, x, y, w, h, &ptr);
 	if (err)
-		return err;
+		goto unlock;
 
 	switch(handle->format) {
 	case HAL_PIXEL_FORMAT_YCbCr_420_888:
@@ -190,11 +533,23 @@ static int drm_mod_lock_ycbcr(const gralloc_module_t *mod, buffer_handle_t bhand
 		ycbcr->cstride = handle->stride;
 		ycbcr->chroma_step = 2;
 		break;
+	case HAL_PIXEL_FORMAT_DRM_P010:
+	case HAL_PIXEL_FORMAT_DRM_P016:
+		/* 16-bit little-endian samples, P010 in the high 10 bits */
+		ycbcr->y = ptr;
+		ycbcr->cb = (uint8_t *)ptr + handle->stride * handle->height;
+		ycbcr->cr = (uint8_t *)ycbcr->cb + 2;
+		ycbcr->ystride = handle->stride;
+		ycbcr->cstride = handle->stride;
+		ycbcr->chroma_step = 4;
+		break;
 	default:
 		break;
 	}
 
-	return 0;
+unlock:
+	pthread_mutex_unlock(&gralloc_lock);
+	return err;
 }
 
 static int drm_mod_unlock(const gralloc_module_t *mod, buffer_handle_t handle)
@@ -262,7 +617,7 @@ static int drm_mod_alloc_gpu0(alloc_device_t *dev,
 
 	bo = gralloc_drm_bo_create(dmod->drm, w, h, format, usage);
 	if (!bo) {
-		err = -ENOMEM;
+		err = (errno == EDQUOT) ? -EDQUOT : -ENOMEM;
 		goto unlock;
 	}
 
@@ -25,19 +25,29 @@
 
 #include <cutils/log.h>
 #include <cutils/atomic.h>
+#include <cutils/properties.h>
+#include <cutils/ashmem.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <dirent.h>
+#include <sys/mman.h>
 
 #include "gralloc_drm.h"
 #include "gralloc_drm_priv.h"
 
 #define unlikely(x) __builtin_expect(!!(x), 0)
 
+#define LARGE_PAGE_MIN_SIZE (1024 * 1024)
+
 static int32_t gralloc_drm_pid = 0;
+static int gralloc_drm_large_pages = 1;
 
 /*
  * Return the pid of the process.
@@ -50,6 +60,44 @@ static int gralloc_drm_get_pid(void)
 	return gralloc_drm_pid;
 }
 
+static pthread_mutex_t gralloc_drm_id_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t gralloc_drm_last_serial = 0;
+
+/*
+ * Return a new buffer id, to be paired with the pid of the process.  The
+ * serial never runs behind the time since boot in us, so a process given a
+ * recycled pid starts past all the ids of the previous owner, unless that
+ * one allocated faster than one bo per us.  64 bits of us do not wrap.
+ */
+static uint64_t gralloc_drm_new_id(void)
+{
+	struct timespec ts;
+	uint64_t now, serial;
+
+	clock_gettime(CLOCK_BOOTTIME, &ts);
+	now = (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+
+	pthread_mutex_lock(&gralloc_drm_id_mutex);
+	serial = MAX(gralloc_drm_last_serial + 1, now);
+	gralloc_drm_last_serial = serial;
+	pthread_mutex_unlock(&gralloc_drm_id_mutex);
+
+	return serial;
+}
+
+_Static_assert(sizeof(struct gralloc_drm_shared) <= DRM_SHARED_SIZE,
+		"shared page overflow");
+
+static struct gralloc_drm_shared *map_shared(int fd)
+{
+	void *ptr;
+
+	ptr = mmap(NULL, DRM_SHARED_SIZE, PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, 0);
+
+	return (ptr != MAP_FAILED) ? (struct gralloc_drm_shared *) ptr : NULL;
+}
+
 /*
  * Create the driver for a DRM fd.
  */
@@ -91,6 +139,18 @@ init_drv_from_fd(int fd)
 			ALOGI_IF(drv, "create nouveau for driver nouveau");
 		} else
 #endif
+#ifdef ENABLE_DUMB
+		if (!strcmp(version->name, "vkms")) {
+			drv = gralloc_drm_drv_create_for_dumb(fd);
+			ALOGI_IF(drv, "create dumb for driver vkms");
+		} else
+#endif
+#ifdef ENABLE_VGEM
+		if (!strcmp(version->name, "vgem")) {
+			drv = gralloc_drm_drv_create_for_vgem(fd);
+			ALOGI_IF(drv, "create vgem for driver vgem");
+		} else
+#endif
 #ifdef ENABLE_PIPE
 		{
 			drv = gralloc_drm_drv_create_for_pipe(fd, version->name);
@@ -108,6 +168,33 @@ init_drv_from_fd(int fd)
 	return drv;
 }
 
+/*
+ * Return a quota in bytes from a property in MiB.
+ */
+static uint64_t get_quota_property(const char *key)
+{
+	return (uint64_t) MAX(property_get_int32(key, 0), 0) << 20;
+}
+
+/*
+ * Open the device of fb0, or the device node in debug.drm.device, such as
+ * a vgem node when there is no GPU.
+ */
+static int open_device(void)
+{
+	char path[PROPERTY_VALUE_MAX];
+	int fd;
+
+	if (!property_get("debug.drm.device", path, NULL))
+		return drmOpenByFB(0, DRM_NODE_PRIMARY);
+
+	fd = open(path, O_RDWR | O_CLOEXEC);
+	if (fd < 0)
+		ALOGE("failed to open %s (%s)", path, strerror(errno));
+
+	return fd;
+}
+
 /*
  * Create a DRM device object.
  */
@@ -119,9 +206,9 @@ struct gralloc_drm_t *gralloc_drm_create(void)
 	if (!drm)
 		return NULL;
 
-	drm->fd = drmOpenByFB(0, DRM_NODE_PRIMARY);
+	drm->fd = open_device();
 	if (drm->fd < 0) {
-		ALOGE("failed to open DRM device of fb0");
+		ALOGE("failed to open DRM device");
 	} else {
 		drm->drv = init_drv_from_fd(drm->fd);
 	}
@@ -132,6 +219,33 @@ struct gralloc_drm_t *gralloc_drm_create(void)
 		return NULL;
 	}
 
+	gralloc_drm_large_pages = property_get_bool("debug.drm.large_pages", 1);
+	pthread_mutex_init(&drm->stats_mutex, NULL);
+	pthread_cond_init(&drm->lock_watchdog_cond, NULL);
+	drm->present_acquire_fence = -1;
+	drm->present_fence = -1;
+	drm->post_acquire_fence = -1;
+	drm->post_fence = -1;
+
+	pthread_mutex_init(&drm->import_cache_mutex, NULL);
+	drm->import_cache_grace = (int64_t) MAX(property_get_int32(
+			"debug.drm.import_cache_ms", 500), 0) * 1000000;
+	gralloc_drm_set_lock_watchdog(drm,
+			MAX(property_get_int32("debug.drm.lock_watchdog_ms", 0), 0));
+
+	drm->quota_limit[GRALLOC_DRM_QUOTA_TOTAL] =
+		get_quota_property("debug.drm.quota_mb");
+	drm->quota_limit[GRALLOC_DRM_QUOTA_TEXTURE] =
+		get_quota_property("debug.drm.quota_texture_mb");
+	drm->quota_limit[GRALLOC_DRM_QUOTA_RENDER] =
+		get_quota_property("debug.drm.quota_render_mb");
+	drm->quota_limit[GRALLOC_DRM_QUOTA_VIDEO] =
+		get_quota_property("debug.drm.quota_video_mb");
+	drm->quota_limit[GRALLOC_DRM_QUOTA_OTHER] =
+		get_quota_property("debug.drm.quota_other_mb");
+	drm->quota_limit[GRALLOC_DRM_QUOTA_DISPLAY] =
+		get_quota_property("debug.drm.quota_display_mb");
+
 	return drm;
 }
 
@@ -140,8 +254,25 @@ struct gralloc_drm_t *gralloc_drm_create(void)
  */
 void gralloc_drm_destroy(struct gralloc_drm_t *drm)
 {
+	gralloc_drm_flush_import_cache(drm);
+	pthread_mutex_destroy(&drm->import_cache_mutex);
+
 	if (drm->drv)
 		drm->drv->destroy(drm->drv);
+
+	if (drm->lock_watchdog_started) {
+		pthread_mutex_lock(&drm->stats_mutex);
+		drm->lock_watchdog_stop = 1;
+		pthread_cond_signal(&drm->lock_watchdog_cond);
+		pthread_mutex_unlock(&drm->stats_mutex);
+		pthread_join(drm->lock_watchdog, NULL);
+	}
+	pthread_cond_destroy(&drm->lock_watchdog_cond);
+	pthread_mutex_destroy(&drm->stats_mutex);
+	if (drm->present_acquire_fence >= 0)
+		close(drm->present_acquire_fence);
+	if (drm->present_fence >= 0)
+		close(drm->present_fence);
 	close(drm->fd);
 	free(drm);
 }
@@ -190,6 +321,217 @@ void gralloc_drm_drop_master(struct gralloc_drm_t *drm)
 	drmDropMaster(drm->fd);
 }
 
+/*
+ * Round the size of a large bo up so that the kernel can back it with
+ * 2MiB or 64KiB GPU pages, and return the matching alignment.  Return 0
+ * and leave the size alone when the bo is small or when the padding would
+ * exceed 1/16 of its size.
+ */
+unsigned long gralloc_drm_large_page_align(unsigned long *size)
+{
+	static const unsigned long page_sizes[] = {
+		2 * 1024 * 1024,
+		64 * 1024,
+	};
+	unsigned int i;
+
+	if (!gralloc_drm_large_pages || *size < LARGE_PAGE_MIN_SIZE)
+		return 0;
+
+	for (i = 0; i < sizeof(page_sizes) / sizeof(page_sizes[0]); i++) {
+		unsigned long aligned = ALIGN(*size, page_sizes[i]);
+
+		if (aligned - *size <= *size / 16) {
+			*size = aligned;
+			return page_sizes[i];
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Free a bo and its fb.
+ */
+static void gralloc_drm_bo_free(struct gralloc_drm_bo_t *bo)
+{
+	struct gralloc_drm_handle_t *handle = bo->handle;
+	int imported = bo->imported;
+
+	gralloc_drm_bo_rm_fb(bo);
+
+	if (bo->shared)
+		munmap(bo->shared, DRM_SHARED_SIZE);
+
+	bo->drm->drv->free(bo->drm->drv, bo);
+	if (imported) {
+		handle->data_owner = 0;
+		handle->data = 0;
+	}
+	else {
+		close(handle->shared_fd);
+		free(handle);
+	}
+}
+
+/*
+ * Free a parked import and remove it from the cache.
+ */
+static void import_cache_evict(struct gralloc_drm_t *drm, int i)
+{
+	struct gralloc_drm_cached_import *entry = &drm->import_cache[i];
+	struct gralloc_drm_bo_t *bo = entry->bo;
+
+	drm->import_cache_bytes -= bo->size;
+	gralloc_drm_bo_free(bo);
+	free(entry->handle);
+
+	*entry = drm->import_cache[--drm->import_cache_count];
+}
+
+/*
+ * Free the parked imports whose grace period is over.  This is done lazily
+ * when the cache is used.
+ */
+static void import_cache_expire(struct gralloc_drm_t *drm, int64_t now)
+{
+	int i = 0;
+
+	while (i < drm->import_cache_count) {
+		if (now - drm->import_cache[i].time >= drm->import_cache_grace)
+			import_cache_evict(drm, i);
+		else
+			i++;
+	}
+}
+
+/*
+ * Return the index of the oldest parked import.
+ */
+static int import_cache_oldest(struct gralloc_drm_t *drm)
+{
+	int i, oldest = 0;
+
+	for (i = 1; i < drm->import_cache_count; i++) {
+		if (drm->import_cache[i].time < drm->import_cache[oldest].time)
+			oldest = i;
+	}
+
+	return oldest;
+}
+
+/*
+ * Free the oldest parked imports until at least bytes are freed or the
+ * cache is empty.
+ */
+static void import_cache_reclaim(struct gralloc_drm_t *drm, uint64_t bytes)
+{
+	uint64_t target;
+
+	pthread_mutex_lock(&drm->import_cache_mutex);
+	target = (drm->import_cache_bytes > bytes) ?
+		drm->import_cache_bytes - bytes : 0;
+	while (drm->import_cache_count && drm->import_cache_bytes > target)
+		import_cache_evict(drm, import_cache_oldest(drm));
+	pthread_mutex_unlock(&drm->import_cache_mutex);
+}
+
+/*
+ * Park an unused import instead of freeing it.  Return true on success.
+ */
+static int import_cache_park(struct gralloc_drm_bo_t *bo)
+{
+	struct gralloc_drm_t *drm = bo->drm;
+	struct gralloc_drm_cached_import *entry;
+	struct gralloc_drm_handle_t *copy;
+	int64_t now = gralloc_drm_get_time_ns();
+
+	if (!drm->import_cache_grace || bo->lock_count ||
+	    bo->size > DRM_IMPORT_CACHE_MAX_BYTES)
+		return 0;
+
+	/* the handle may be gone once unregistered */
+	copy = malloc(sizeof(*copy));
+	if (!copy)
+		return 0;
+	*copy = *bo->handle;
+
+	pthread_mutex_lock(&drm->import_cache_mutex);
+
+	import_cache_expire(drm, now);
+
+	/* make room by evicting the oldest */
+	while (drm->import_cache_count == DRM_IMPORT_CACHE_SIZE ||
+	       drm->import_cache_bytes + bo->size > DRM_IMPORT_CACHE_MAX_BYTES)
+		import_cache_evict(drm, import_cache_oldest(drm));
+
+	bo->handle->data_owner = 0;
+	bo->handle->data = 0;
+	bo->handle = copy;
+
+	entry = &drm->import_cache[drm->import_cache_count++];
+	entry->bo = bo;
+	entry->handle = copy;
+	entry->time = now;
+	drm->import_cache_bytes += bo->size;
+
+	pthread_mutex_unlock(&drm->import_cache_mutex);
+
+	return 1;
+}
+
+/*
+ * Revive a parked import of the same GEM object, which is identified by
+ * its name and id, and the same geometry.
+ */
+static struct gralloc_drm_bo_t *import_cache_lookup(struct gralloc_drm_t *drm,
+		struct gralloc_drm_handle_t *handle)
+{
+	struct gralloc_drm_bo_t *bo = NULL;
+	int i;
+
+	pthread_mutex_lock(&drm->import_cache_mutex);
+
+	import_cache_expire(drm, gralloc_drm_get_time_ns());
+
+	for (i = 0; i < drm->import_cache_count; i++) {
+		struct gralloc_drm_cached_import *entry = &drm->import_cache[i];
+
+		if (entry->handle->name == handle->name &&
+		    entry->handle->id == handle->id &&
+		    entry->handle->id_pid == handle->id_pid &&
+		    entry->handle->width == handle->width &&
+		    entry->handle->height == handle->height &&
+		    entry->handle->format == handle->format &&
+		    entry->handle->usage == handle->usage &&
+		    entry->handle->stride == handle->stride) {
+			bo = entry->bo;
+			bo->handle = handle;
+			drm->import_cache_bytes -= bo->size;
+			drm->import_cache_hits++;
+
+			free(entry->handle);
+			*entry = drm->import_cache[--drm->import_cache_count];
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&drm->import_cache_mutex);
+
+	return bo;
+}
+
+/*
+ * Free all parked imports.
+ */
+void gralloc_drm_flush_import_cache(struct gralloc_drm_t *drm)
+{
+	pthread_mutex_lock(&drm->import_cache_mutex);
+	while (drm->import_cache_count)
+		import_cache_evict(drm, drm->import_cache_count - 1);
+	pthread_mutex_unlock(&drm->import_cache_mutex);
+}
+
 /*
  * Validate a buffer handle and return the associated bo.
  */
@@ -204,21 +546,38 @@ static struct gralloc_drm_bo_t *validate_handle(buffer_handle_t _handle,
 	/* the buffer handle is passed to a new process */
 	if (unlikely(handle->data_owner != gralloc_drm_get_pid())) {
 		struct gralloc_drm_bo_t *bo;
+		int64_t start;
 
 		/* check only */
 		if (!drm)
 			return NULL;
 
+		start = gralloc_drm_get_time_ns();
+
 		/* create the struct gralloc_drm_bo_t locally */
-		if (handle->name)
-			bo = drm->drv->alloc(drm->drv, handle);
-		else /* an invalid handle */
+		if (handle->name) {
+			bo = import_cache_lookup(drm, handle);
+			if (!bo)
+				bo = drm->drv->alloc(drm->drv, handle, NULL);
+		}
+		else { /* an invalid handle */
 			bo = NULL;
+		}
 		if (bo) {
 			bo->drm = drm;
 			bo->imported = 1;
 			bo->handle = handle;
 			bo->refcount = 1;
+
+			if (!bo->shared) {
+				bo->shared = map_shared(handle->shared_fd);
+				ALOGW_IF(!bo->shared, "failed to map shared page of bo %p", bo);
+			}
+
+			pthread_mutex_lock(&drm->stats_mutex);
+			drm->imported_bos++;
+			pthread_mutex_unlock(&drm->stats_mutex);
+			gralloc_drm_add_latency(drm, DRM_LATENCY_IMPORT, start);
 		}
 
 		handle->data_owner = gralloc_drm_get_pid();
@@ -278,7 +637,17 @@ static struct gralloc_drm_handle_t *create_bo_handle(int width,
 	handle->base.numInts = GRALLOC_DRM_HANDLE_NUM_INTS;
 	handle->base.numFds = GRALLOC_DRM_HANDLE_NUM_FDS;
 
+	handle->shared_fd = ashmem_create_region("gralloc-drm-shared",
+			DRM_SHARED_SIZE);
+	if (handle->shared_fd < 0) {
+		ALOGE("failed to create shared page");
+		free(handle);
+		return NULL;
+	}
+
 	handle->magic = GRALLOC_DRM_HANDLE_MAGIC;
+	handle->id = gralloc_drm_new_id();
+	handle->id_pid = gralloc_drm_get_pid();
 	handle->width = width;
 	handle->height = height;
 	handle->format = format;
@@ -289,14 +658,360 @@ static struct gralloc_drm_handle_t *create_bo_handle(int width,
 	return handle;
 }
 
+/*
+ * Return the quota class of a usage.
+ */
+static int get_quota_class(int usage)
+{
+	if (usage & (GRALLOC_USAGE_HW_VIDEO_ENCODER |
+		     GRALLOC_USAGE_HW_CAMERA_MASK))
+		return GRALLOC_DRM_QUOTA_VIDEO;
+	/* app buffers have HW_COMPOSER too, so only HW_FB tells these apart */
+	if (usage & GRALLOC_USAGE_HW_FB)
+		return GRALLOC_DRM_QUOTA_DISPLAY;
+	if (usage & GRALLOC_USAGE_HW_RENDER)
+		return GRALLOC_DRM_QUOTA_RENDER;
+	if (usage & GRALLOC_USAGE_HW_TEXTURE)
+		return GRALLOC_DRM_QUOTA_TEXTURE;
+
+	return GRALLOC_DRM_QUOTA_OTHER;
+}
+
+static pthread_once_t alloc_client_once = PTHREAD_ONCE_INIT;
+static pthread_key_t alloc_client_key;
+
+static void alloc_client_init(void)
+{
+	pthread_key_create(&alloc_client_key, NULL);
+}
+
+/*
+ * Charge the bos allocated by the calling thread to the process pid, or to
+ * this process when pid is 0.  An allocator serving other processes, such
+ * as the compositor in gralloc0, sets the pid of the caller around each
+ * allocation.  Otherwise the allocator is charged for all of them.
+ */
+void gralloc_drm_set_alloc_client(int pid)
+{
+	pthread_once(&alloc_client_once, alloc_client_init);
+	pthread_setspecific(alloc_client_key, (void *) (intptr_t) pid);
+}
+
+/*
+ * Return the pid the bos allocated by the calling thread are charged to.
+ */
+static int get_alloc_client(void)
+{
+	int pid;
+
+	pthread_once(&alloc_client_once, alloc_client_init);
+	pid = (int) (intptr_t) pthread_getspecific(alloc_client_key);
+
+	return (pid) ? pid : gralloc_drm_get_pid();
+}
+
+/*
+ * Find the quota use of a client, or give it a free slot when alloc is
+ * set.  Called with stats_mutex held.
+ */
+static struct gralloc_drm_quota_client *find_quota_client(
+		struct gralloc_drm_t *drm, int pid, int alloc)
+{
+	struct gralloc_drm_quota_client *free_slot = NULL;
+	int i;
+
+	for (i = 0; i < DRM_QUOTA_MAX_CLIENTS; i++) {
+		struct gralloc_drm_quota_client *client = &drm->quota_clients[i];
+
+		if (client->pid == pid)
+			return client;
+		if (!free_slot && !client->pid)
+			free_slot = client;
+	}
+
+	if (alloc && free_slot) {
+		memset(free_slot, 0, sizeof(*free_slot));
+		free_slot->pid = pid;
+	}
+
+	return (alloc) ? free_slot : NULL;
+}
+
+/*
+ * Return by how many bytes allocating more bytes would exceed a quota of a
+ * client, or 0.  Called with stats_mutex held.
+ */
+static uint64_t quota_overage(struct gralloc_drm_t *drm,
+		const struct gralloc_drm_quota_client *client,
+		int quota, uint64_t bytes)
+{
+	uint64_t used = (client) ? client->used[quota] : 0;
+
+	if (!drm->quota_limit[quota] ||
+	    used + bytes <= drm->quota_limit[quota])
+		return 0;
+
+	return used + bytes - drm->quota_limit[quota];
+}
+
+/*
+ * Check that a bo of the given size and usage fits in the quotas of a
+ * client.  Parked imports are held by this process and count against its
+ * own total quota, and just enough of them are reclaimed to make the bo
+ * fit.
+ */
+static int check_quota(struct gralloc_drm_t *drm, int pid, int usage,
+		uint64_t bytes)
+{
+	const struct gralloc_drm_quota_client *client;
+	int class = get_quota_class(usage);
+	uint64_t cached = 0, excess = 0, over;
+
+	pthread_mutex_lock(&drm->stats_mutex);
+	client = find_quota_client(drm, pid, 0);
+	over = quota_overage(drm, client, class, bytes);
+	if (over)
+		drm->quota_hits[class]++;
+	pthread_mutex_unlock(&drm->stats_mutex);
+
+	if (over) {
+		ALOGW("quota of class %d of pid %d exceeded by %llu bytes",
+				class, pid, (unsigned long long) over);
+		return -EDQUOT;
+	}
+
+	if (pid == gralloc_drm_get_pid()) {
+		pthread_mutex_lock(&drm->import_cache_mutex);
+		cached = drm->import_cache_bytes;
+		pthread_mutex_unlock(&drm->import_cache_mutex);
+	}
+
+	pthread_mutex_lock(&drm->stats_mutex);
+	client = find_quota_client(drm, pid, 0);
+	/* reclaiming does not help when the local bos alone are over */
+	over = quota_overage(drm, client, GRALLOC_DRM_QUOTA_TOTAL, bytes);
+	if (over) {
+		drm->quota_hits[GRALLOC_DRM_QUOTA_TOTAL]++;
+	}
+	else if (cached) {
+		excess = quota_overage(drm, client, GRALLOC_DRM_QUOTA_TOTAL,
+				bytes + cached);
+		if (excess)
+			drm->quota_reclaims++;
+	}
+	pthread_mutex_unlock(&drm->stats_mutex);
+
+	if (excess)
+		import_cache_reclaim(drm, excess);
+
+	if (over) {
+		ALOGW("total quota of pid %d exceeded by %llu bytes", pid,
+				(unsigned long long) over);
+		return -EDQUOT;
+	}
+
+	return 0;
+}
+
+/*
+ * Add or remove a local bo to or from the quota accounting of its client.
+ */
+static void gralloc_drm_bo_account_quota(struct gralloc_drm_bo_t *bo,
+		int add)
+{
+	struct gralloc_drm_t *drm = bo->drm;
+	struct gralloc_drm_quota_client *client;
+	int class = get_quota_class(bo->handle->usage);
+
+	pthread_mutex_lock(&drm->stats_mutex);
+
+	/* 0 when the bo is not charged to any client */
+	client = (bo->quota_client) ?
+		find_quota_client(drm, bo->quota_client, add) : NULL;
+	if (add) {
+		drm->quota_used[GRALLOC_DRM_QUOTA_TOTAL] += bo->size;
+		drm->quota_used[class] += bo->size;
+		if (client) {
+			client->used[GRALLOC_DRM_QUOTA_TOTAL] += bo->size;
+			client->used[class] += bo->size;
+		}
+		else {
+			ALOGW("too many clients, not limiting pid %d",
+					bo->quota_client);
+			bo->quota_client = 0;
+		}
+	}
+	else {
+		drm->quota_used[GRALLOC_DRM_QUOTA_TOTAL] -= bo->size;
+		drm->quota_used[class] -= bo->size;
+		if (client) {
+			client->used[GRALLOC_DRM_QUOTA_TOTAL] -= bo->size;
+			client->used[class] -= bo->size;
+			/* free the slot */
+			if (!client->used[GRALLOC_DRM_QUOTA_TOTAL])
+				client->pid = 0;
+		}
+	}
+
+	pthread_mutex_unlock(&drm->stats_mutex);
+}
+
+/*
+ * Add or remove a local bo to or from the allocation accounting.
+ */
+static void gralloc_drm_bo_account(struct gralloc_drm_bo_t *bo, int add)
+{
+	struct gralloc_drm_alloc_stats *stats = &bo->drm->alloc_stats;
+	uint64_t requested = gralloc_drm_get_tight_size(bo->handle->format,
+			bo->handle->width, bo->handle->height);
+
+	if (add) {
+		stats->bo_count++;
+		stats->requested_bytes += requested;
+		stats->allocated_bytes += bo->size;
+	}
+	else {
+		stats->bo_count--;
+		stats->requested_bytes -= requested;
+		stats->allocated_bytes -= bo->size;
+	}
+
+	gralloc_drm_bo_account_quota(bo, add);
+}
+
+/*
+ * Merge the constraints of all consumers of a buffer.  Return -EINVAL when
+ * they cannot be satisfied at the same time.
+ */
+int gralloc_drm_merge_constraints(const struct gralloc_drm_constraints *list,
+		int count, struct gralloc_drm_constraints *merged)
+{
+	int i;
+
+	memset(merged, 0, sizeof(*merged));
+
+	for (i = 0; i < count; i++) {
+		const struct gralloc_drm_constraints *c = &list[i];
+
+		/* alignments are merged by taking the largest */
+		if ((c->stride_align & (c->stride_align - 1)) ||
+		    (c->offset_align & (c->offset_align - 1))) {
+			ALOGE("constraint %d has a non power of two alignment "
+					"(stride %u, offset %u)", i,
+					c->stride_align, c->offset_align);
+			return -EINVAL;
+		}
+
+		merged->stride_align = MAX(merged->stride_align,
+				c->stride_align);
+		merged->offset_align = MAX(merged->offset_align,
+				c->offset_align);
+		merged->linear |= c->linear;
+		merged->contiguous |= c->contiguous;
+	}
+
+	return 0;
+}
+
+/*
+ * Return true if the layout of a handle satisfies the constraints.
+ */
+static int check_constraints(const struct gralloc_drm_handle_t *handle,
+		const struct gralloc_drm_constraints *constraints)
+{
+	struct gralloc_drm_plane_layout layout;
+	int i;
+
+	if (constraints->stride_align &&
+	    handle->stride % constraints->stride_align)
+		return 0;
+
+	if (constraints->offset_align) {
+		gralloc_drm_get_plane_layout(handle->format, handle->stride,
+				handle->height, &layout);
+		for (i = 0; i < layout.num_planes; i++) {
+			if (layout.offsets[i] % constraints->offset_align)
+				return 0;
+		}
+	}
+
+	return 1;
+}
+
+/*
+ * Return the pitch alignment that makes rows of the pitch a multiple of
+ * offset_align.
+ */
+static uint32_t get_pitch_align(uint32_t offset_align, int rows)
+{
+	while (offset_align > 1 && !(rows & 1)) {
+		offset_align >>= 1;
+		rows >>= 1;
+	}
+
+	return offset_align;
+}
+
 /*
  * Create a bo.
  */
 struct gralloc_drm_bo_t *gralloc_drm_bo_create(struct gralloc_drm_t *drm,
 		int width, int height, int format, int usage)
 {
+	return gralloc_drm_bo_create_constrained(drm, width, height,
+			format, usage, NULL);
+}
+
+/*
+ * Create a bo whose layout satisfies merged constraints, or fail without
+ * falling back to another layout.
+ */
+struct gralloc_drm_bo_t *gralloc_drm_bo_create_constrained(
+		struct gralloc_drm_t *drm, int width, int height,
+		int format, int usage,
+		const struct gralloc_drm_constraints *constraints)
+{
+	int64_t start = gralloc_drm_get_time_ns();
+	struct gralloc_drm_constraints c;
 	struct gralloc_drm_bo_t *bo;
 	struct gralloc_drm_handle_t *handle;
+	int client = get_alloc_client();
+
+	if (constraints) {
+		c = *constraints;
+
+		/*
+		 * Align the pitch so that the plane offsets are aligned as
+		 * well.  The 2nd plane starts at a multiple of the pitch.  The
+		 * 3rd plane of a 3-plane format is further offset by rows of
+		 * half the pitch.
+		 */
+		if (c.offset_align && height > 0) {
+			struct gralloc_drm_plane_layout layout;
+			uint32_t align;
+
+			align = get_pitch_align(c.offset_align, height);
+
+			gralloc_drm_get_plane_layout(format, 0, height, &layout);
+			if (layout.num_planes == 3)
+				align = MAX(align, 2 * get_pitch_align(
+						c.offset_align, (height + 1) / 2));
+
+			c.stride_align = MAX(c.stride_align, align);
+		}
+
+		constraints = &c;
+	}
+
+	/* EDQUOT tells the caller that a quota is hit */
+	errno = 0;
+
+	/* estimated from the tight size; the real size is accounted */
+	if (check_quota(drm, client, usage,
+			gralloc_drm_get_tight_size(format, width, height))) {
+		errno = EDQUOT;
+		return NULL;
+	}
 
 	handle = create_bo_handle(width, height, format, usage);
 	if (!handle)
@@ -304,8 +1019,28 @@ struct gralloc_drm_bo_t *gralloc_drm_bo_create(struct gralloc_drm_t *drm,
 
 	handle->plane_mask = planes_for_format(drm, format);
 
-	bo = drm->drv->alloc(drm->drv, handle);
+	bo = drm->drv->alloc(drm->drv, handle, constraints);
 	if (!bo) {
+		close(handle->shared_fd);
+		free(handle);
+		return NULL;
+	}
+
+	if (constraints && !check_constraints(handle, constraints)) {
+		ALOGE("layout of %dx%d (format 0x%x) with stride %d does not "
+				"satisfy the constraints", width, height,
+				format, handle->stride);
+		drm->drv->free(drm->drv, bo);
+		close(handle->shared_fd);
+		free(handle);
+		return NULL;
+	}
+
+	bo->shared = map_shared(handle->shared_fd);
+	if (!bo->shared) {
+		ALOGE("failed to map shared page");
+		drm->drv->free(drm->drv, bo);
+		close(handle->shared_fd);
 		free(handle);
 		return NULL;
 	}
@@ -315,6 +1050,19 @@ struct gralloc_drm_bo_t *gralloc_drm_bo_create(struct gralloc_drm_t *drm,
 	bo->handle = handle;
 	bo->fb_id = 0;
 	bo->refcount = 1;
+	bo->quota_client = client;
+
+	/* estimate the size when the driver does not know it */
+	if (!bo->size) {
+		int aligned_width = width, aligned_height = height;
+
+		gralloc_drm_align_geometry(format,
+				&aligned_width, &aligned_height);
+		bo->size = handle->stride * aligned_height;
+	}
+
+	gralloc_drm_bo_account(bo, 1);
+	gralloc_drm_add_latency(drm, DRM_LATENCY_ALLOC, start);
 
 	handle->data_owner = gralloc_drm_get_pid();
 	handle->data = bo;
@@ -323,27 +1071,99 @@ struct gralloc_drm_bo_t *gralloc_drm_bo_create(struct gralloc_drm_t *drm,
 }
 
 /*
- * Destroy a bo.
+ * Add a duration to a histogram.
  */
-static void gralloc_drm_bo_destroy(struct gralloc_drm_bo_t *bo)
+void gralloc_drm_histogram_add(struct gralloc_drm_histogram *hist,
+		uint64_t us)
 {
-	struct gralloc_drm_handle_t *handle = bo->handle;
-	int imported = bo->imported;
+	int i = 0;
 
+	while (i < GRALLOC_DRM_HISTOGRAM_BUCKETS - 1 && (us >> (i + 1)))
+		i++;
+
+	hist->buckets[i]++;
+	hist->count++;
+	hist->total_us += us;
+	if (hist->max_us < us)
+		hist->max_us = us;
+}
+
+/*
+ * Sample the latency of an operation started at the given time.
+ */
+void gralloc_drm_add_latency(struct gralloc_drm_t *drm,
+		enum drm_latency op, int64_t start)
+{
+	int64_t end = gralloc_drm_get_time_ns();
+
+	pthread_mutex_lock(&drm->stats_mutex);
+	gralloc_drm_histogram_add(&drm->latency[op], (end - start) / 1000);
+	pthread_mutex_unlock(&drm->stats_mutex);
+}
+
+/*
+ * Start or stop tracking a CPU lock of a bo.
+ */
+static void gralloc_drm_bo_track_lock(struct gralloc_drm_bo_t *bo,
+		int locked)
+{
+	struct gralloc_drm_t *drm = bo->drm;
+
+	pthread_mutex_lock(&drm->stats_mutex);
+	if (locked) {
+		bo->lock_time = gralloc_drm_get_time_ns();
+		bo->lock_tid = gettid();
+		bo->lock_reported = 0;
+
+		bo->lock_prev = NULL;
+		bo->lock_next = drm->locked_bos;
+		if (drm->locked_bos)
+			drm->locked_bos->lock_prev = bo;
+		drm->locked_bos = bo;
+	}
+	else {
+		gralloc_drm_histogram_add(&drm->lock_hold,
+				(gralloc_drm_get_time_ns() - bo->lock_time) / 1000);
+
+		if (bo->lock_prev)
+			bo->lock_prev->lock_next = bo->lock_next;
+		else
+			drm->locked_bos = bo->lock_next;
+		if (bo->lock_next)
+			bo->lock_next->lock_prev = bo->lock_prev;
+		bo->lock_prev = NULL;
+		bo->lock_next = NULL;
+		bo->lock_tid = 0;
+	}
+	pthread_mutex_unlock(&drm->stats_mutex);
+}
+
+/*
+ * Destroy a bo.  Imports are parked for a while in case they are registered
+ * again.
+ */
+static void gralloc_drm_bo_destroy(struct gralloc_drm_bo_t *bo)
+{
 	/* gralloc still has a reference */
 	if (bo->refcount)
 		return;
 
-	gralloc_drm_bo_rm_fb(bo);
+	if (bo->imported) {
+		pthread_mutex_lock(&bo->drm->stats_mutex);
+		bo->drm->imported_bos--;
+		pthread_mutex_unlock(&bo->drm->stats_mutex);
 
-	bo->drm->drv->free(bo->drm->drv, bo);
-	if (imported) {
-		handle->data_owner = 0;
-		handle->data = 0;
+		if (import_cache_park(bo))
+			return;
 	}
 	else {
-		free(handle);
+		gralloc_drm_bo_account(bo, 0);
 	}
+
+	if (bo->lock_count)
+		gralloc_drm_bo_track_lock(bo, 0);
+
+	gralloc_drm_bo_free(bo);
 }
 
 /*
@@ -373,6 +1193,41 @@ buffer_handle_t gralloc_drm_bo_get_handle(struct gralloc_drm_bo_t *bo, int *stri
 	return &bo->handle->base;
 }
 
+/*
+ * Get the tightly packed and the real sizes of a bo.
+ */
+void gralloc_drm_bo_get_alloc_info(const struct gralloc_drm_bo_t *bo,
+		uint64_t *requested, uint64_t *allocated)
+{
+	*requested = gralloc_drm_get_tight_size(bo->handle->format,
+			bo->handle->width, bo->handle->height);
+	*allocated = bo->size;
+}
+
+/*
+ * Get the allocation accounting of the bos allocated by this process.
+ */
+void gralloc_drm_get_alloc_stats(struct gralloc_drm_t *drm,
+		struct gralloc_drm_alloc_stats *stats)
+{
+	*stats = drm->alloc_stats;
+}
+
+/*
+ * Get the quotas of the bos allocated by this process, which apply to each
+ * client, and their use by all clients.
+ */
+void gralloc_drm_get_quota_stats(struct gralloc_drm_t *drm,
+		struct gralloc_drm_quota_stats *stats)
+{
+	pthread_mutex_lock(&drm->stats_mutex);
+	memcpy(stats->limit, drm->quota_limit, sizeof(stats->limit));
+	memcpy(stats->used, drm->quota_used, sizeof(stats->used));
+	memcpy(stats->hits, drm->quota_hits, sizeof(stats->hits));
+	stats->reclaims = drm->quota_reclaims;
+	pthread_mutex_unlock(&drm->stats_mutex);
+}
+
 int gralloc_drm_get_gem_handle(buffer_handle_t _handle)
 {
 	struct gralloc_drm_handle_t *handle = gralloc_drm_handle(_handle);
@@ -429,17 +1284,33 @@ int gralloc_drm_bo_lock(struct gralloc_drm_bo_t *bo,
 
 	if (usage & (GRALLOC_USAGE_SW_WRITE_MASK |
 		     GRALLOC_USAGE_SW_READ_MASK)) {
-		/* the driver is supposed to wait for the bo */
 		int write = !!(usage & GRALLOC_USAGE_SW_WRITE_MASK);
-		int err = bo->drm->drv->map(bo->drm->drv, bo,
+		int64_t start;
+		int err;
+
+		/* the driver is supposed to wait for the bo */
+		start = gralloc_drm_get_time_ns();
+		err = bo->drm->drv->map(bo->drm->drv, bo,
 				x, y, w, h, write, addr);
 		if (err)
 			return err;
+
+		gralloc_drm_add_latency(bo->drm, DRM_LATENCY_LOCK, start);
+
+		if (w <= 0 || h <= 0) {
+			w = bo->handle->width;
+			h = bo->handle->height;
+		}
+		gralloc_drm_add_traffic(bo->drm, DRM_TRAFFIC_MAP,
+				gralloc_drm_get_tight_size(bo->handle->format, w, h));
 	}
 	else {
 		/* kernel handles the synchronization here */
 	}
 
+	if (!bo->lock_count)
+		gralloc_drm_bo_track_lock(bo, 1);
+
 	bo->lock_count++;
 	bo->locked_for |= usage;
 
@@ -460,7 +1331,433 @@ void gralloc_drm_bo_unlock(struct gralloc_drm_bo_t *bo)
 	if (mapped)
 		bo->drm->drv->unmap(bo->drm->drv, bo);
 
+	if ((bo->locked_for & GRALLOC_USAGE_SW_WRITE_MASK) && bo->shared)
+		android_atomic_inc(&bo->shared->generation);
+
 	bo->lock_count--;
-	if (!bo->lock_count)
+	if (!bo->lock_count) {
 		bo->locked_for = 0;
+		gralloc_drm_bo_track_lock(bo, 0);
+	}
+}
+
+/*
+ * Return the generation of the content of a bo.  It is bumped after each
+ * CPU write and by gralloc_drm_bo_bump_generation, and shared by all
+ * processes.
+ */
+uint32_t gralloc_drm_bo_get_generation(struct gralloc_drm_bo_t *bo)
+{
+	return (bo->shared) ?
+		(uint32_t) android_atomic_acquire_load(&bo->shared->generation) : 0;
+}
+
+/*
+ * Bump the generation of a bo, for writers that do not lock it, such as
+ * the GPU.
+ */
+void gralloc_drm_bo_bump_generation(struct gralloc_drm_bo_t *bo)
+{
+	if (bo->shared)
+		android_atomic_inc(&bo->shared->generation);
+}
+
+/* check the owner after the metadata has been locked for that many tries */
+#define METADATA_MAX_TRIES 1000
+
+static void *metadata_field(struct gralloc_drm_shared *shared,
+		int type, size_t *size)
+{
+	switch (type) {
+	case GRALLOC_DRM_METADATA_CROP:
+		*size = sizeof(shared->crop);
+		return &shared->crop;
+	case GRALLOC_DRM_METADATA_DATASPACE:
+		*size = sizeof(shared->dataspace);
+		return &shared->dataspace;
+	case GRALLOC_DRM_METADATA_DAMAGE:
+		*size = sizeof(shared->damage);
+		return &shared->damage;
+	case GRALLOC_DRM_METADATA_HDR:
+		*size = sizeof(shared->hdr);
+		return &shared->hdr;
+	case GRALLOC_DRM_METADATA_TIMESTAMP:
+		*size = sizeof(shared->timestamp);
+		return &shared->timestamp;
+	default:
+		*size = 0;
+		return NULL;
+	}
+}
+
+/*
+ * Take the metadata lock from an owner that died while holding it.  A
+ * seqlock left odd means the metadata may be torn, so all of it is dropped.
+ * Return -EBUSY if the owner is unknown or still alive.
+ */
+static int metadata_recover(struct gralloc_drm_shared *shared, int32_t owner)
+{
+	int32_t seq;
+
+	if (!owner || !kill(owner, 0) || errno != ESRCH)
+		return -EBUSY;
+
+	if (android_atomic_acquire_cas(owner, gettid(), &shared->metadata_owner))
+		return -EBUSY;
+
+	seq = shared->metadata_seq;
+	if (seq & 1) {
+		ALOGW("dropping the metadata left locked by dead thread %d",
+				owner);
+		shared->metadata_mask = 0;
+		android_atomic_release_store(seq + 1, &shared->metadata_seq);
+	}
+
+	return 0;
+}
+
+/*
+ * Take the lock writers of the metadata hold around the seqlock.
+ */
+static int metadata_lock(struct gralloc_drm_shared *shared)
+{
+	int32_t tid = gettid(), owner = 0;
+	int tries;
+
+	for (tries = 0; tries < METADATA_MAX_TRIES; tries++) {
+		owner = android_atomic_acquire_load(&shared->metadata_owner);
+		if (!owner && !android_atomic_acquire_cas(0, tid,
+					&shared->metadata_owner))
+			return 0;
+		sched_yield();
+	}
+
+	return metadata_recover(shared, owner);
+}
+
+static void metadata_unlock(struct gralloc_drm_shared *shared)
+{
+	android_atomic_release_store(0, &shared->metadata_owner);
+}
+
+/*
+ * Wait until the seqlock of the metadata is even and get it.
+ */
+static int metadata_wait(struct gralloc_drm_shared *shared, int32_t *seq)
+{
+	int tries;
+
+	for (tries = 0; tries < METADATA_MAX_TRIES; tries++) {
+		*seq = android_atomic_acquire_load(&shared->metadata_seq);
+		if (!(*seq & 1))
+			return 0;
+		sched_yield();
+	}
+
+	/* the seqlock is only odd while its owner is known */
+	if (!metadata_recover(shared,
+			android_atomic_acquire_load(&shared->metadata_owner))) {
+		metadata_unlock(shared);
+		*seq = android_atomic_acquire_load(&shared->metadata_seq);
+		if (!(*seq & 1))
+			return 0;
+	}
+
+	return -EBUSY;
+}
+
+/*
+ * Get a metadata of a bo.  Return -ENOENT when it is not set.
+ */
+int gralloc_drm_bo_get_metadata(struct gralloc_drm_bo_t *bo,
+		int type, void *data, size_t size)
+{
+	struct gralloc_drm_shared *shared = bo->shared;
+	size_t field_size;
+	void *field;
+	int tries, set;
+
+	if (!shared)
+		return -ENODEV;
+
+	field = metadata_field(shared, type, &field_size);
+	if (!field || size != field_size)
+		return -EINVAL;
+
+	for (tries = 0; tries < METADATA_MAX_TRIES; tries++) {
+		int32_t seq;
+		int err;
+
+		err = metadata_wait(shared, &seq);
+		if (err)
+			return err;
+
+		set = !!(shared->metadata_mask & (1 << type));
+		if (set)
+			memcpy(data, field, size);
+
+		android_memory_barrier();
+		if (android_atomic_acquire_load(&shared->metadata_seq) == seq)
+			return (set) ? 0 : -ENOENT;
+	}
+
+	return -EBUSY;
+}
+
+/*
+ * Set a metadata of a bo, or clear it when data is NULL.
+ */
+int gralloc_drm_bo_set_metadata(struct gralloc_drm_bo_t *bo,
+		int type, const void *data, size_t size)
+{
+	struct gralloc_drm_shared *shared = bo->shared;
+	size_t field_size;
+	void *field;
+	int32_t seq;
+	int err;
+
+	if (!shared)
+		return -ENODEV;
+
+	field = metadata_field(shared, type, &field_size);
+	if (!field || (data && size != field_size))
+		return -EINVAL;
+
+	err = metadata_lock(shared);
+	if (err)
+		return err;
+
+	/* only the owner of the lock changes the seqlock */
+	seq = shared->metadata_seq;
+	android_atomic_release_store(seq + 1, &shared->metadata_seq);
+	android_memory_barrier();
+
+	if (data) {
+		memcpy(field, data, size);
+		shared->metadata_mask |= 1 << type;
+	}
+	else {
+		shared->metadata_mask &= ~(1 << type);
+	}
+
+	android_atomic_release_store(seq + 2, &shared->metadata_seq);
+	metadata_unlock(shared);
+
+	return 0;
+}
+
+/*
+ * Attach a fence to a bo, as if a GPU were reading or writing it, until
+ * the fence is signaled by gralloc_drm_signal_fence.
+ */
+int gralloc_drm_bo_attach_fence(struct gralloc_drm_bo_t *bo,
+		int write, uint32_t *fence)
+{
+	struct gralloc_drm_drv_t *drv = bo->drm->drv;
+
+	if (!drv->attach_fence)
+		return -ENOSYS;
+
+	return drv->attach_fence(drv, bo, write, fence);
+}
+
+/*
+ * Signal a fence attached by gralloc_drm_bo_attach_fence.
+ */
+int gralloc_drm_signal_fence(struct gralloc_drm_t *drm, uint32_t fence)
+{
+	if (!drm->drv->signal_fence)
+		return -ENOSYS;
+
+	return drm->drv->signal_fence(drm->drv, fence);
+}
+
+/*
+ * Get the gallium pipe_screen allocations are made with.  It is not the
+ * screen of EGL, which Mesa does not expose.  A caller that creates a
+ * screen for the same fd from the same gallium_dri.so shares the winsys
+ * with it.  The screen is owned by gralloc, must not be destroyed, and
+ * stays valid while the device is open.
+ */
+int gralloc_drm_get_pipe_screen(struct gralloc_drm_t *drm, void **screen)
+{
+	*screen = (drm->drv->get_pipe_screen) ?
+		drm->drv->get_pipe_screen(drm->drv) : NULL;
+
+	return (*screen) ? 0 : -ENOSYS;
+}
+
+/*
+ * Get the holder of a CPU lock of a bo and for how long it has held the
+ * lock.  The tid is 0 when the bo is not locked.
+ */
+void gralloc_drm_bo_get_lock_info(struct gralloc_drm_bo_t *bo,
+		int *tid, uint64_t *held_us)
+{
+	struct gralloc_drm_t *drm = bo->drm;
+
+	pthread_mutex_lock(&drm->stats_mutex);
+	*tid = bo->lock_tid;
+	*held_us = (bo->lock_count) ?
+		(gralloc_drm_get_time_ns() - bo->lock_time) / 1000 : 0;
+	pthread_mutex_unlock(&drm->stats_mutex);
+}
+
+/*
+ * Get the statistics of CPU locks.
+ */
+void gralloc_drm_get_lock_stats(struct gralloc_drm_t *drm,
+		struct gralloc_drm_lock_stats *stats)
+{
+	int64_t now = gralloc_drm_get_time_ns();
+	struct gralloc_drm_bo_t *bo;
+
+	memset(stats, 0, sizeof(*stats));
+
+	pthread_mutex_lock(&drm->stats_mutex);
+	for (bo = drm->locked_bos; bo; bo = bo->lock_next) {
+		uint64_t held_us = (now - bo->lock_time) / 1000;
+
+		stats->locked_bos++;
+		if (stats->oldest_us <= held_us) {
+			stats->oldest_us = held_us;
+			stats->oldest_tid = bo->lock_tid;
+		}
+	}
+	stats->long_locks = drm->long_locks;
+	stats->watchdog_ms = drm->lock_watchdog_ms;
+	stats->hold = drm->lock_hold;
+	pthread_mutex_unlock(&drm->stats_mutex);
+}
+
+/*
+ * Return the number of open fds of the process.
+ */
+static uint32_t gralloc_drm_count_fds(void)
+{
+	struct dirent *ent;
+	uint32_t count = 0;
+	DIR *dir;
+
+	dir = opendir("/proc/self/fd");
+	if (!dir)
+		return 0;
+
+	while ((ent = readdir(dir)) != NULL) {
+		if (ent->d_name[0] != '.')
+			count++;
+	}
+	closedir(dir);
+
+	/* do not count the fd of dir */
+	return (count) ? count - 1 : 0;
+}
+
+/*
+ * Get the resources held by the process and the latencies of the main
+ * operations.  The latencies are cleared when reset is true.
+ */
+void gralloc_drm_get_resource_stats(struct gralloc_drm_t *drm,
+		struct gralloc_drm_resource_stats *stats, int reset)
+{
+	struct gralloc_drm_bo_t *bo;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->fds = gralloc_drm_count_fds();
+
+	pthread_mutex_lock(&drm->stats_mutex);
+	stats->local_bos = drm->alloc_stats.bo_count;
+	stats->imported_bos = drm->imported_bos;
+	stats->fbs = drm->fb_count;
+
+	for (bo = drm->locked_bos; bo; bo = bo->lock_next) {
+		if (bo->locked_for & (GRALLOC_USAGE_SW_WRITE_MASK |
+					GRALLOC_USAGE_SW_READ_MASK))
+			stats->mapped_bytes += bo->size;
+	}
+
+	stats->alloc = drm->latency[DRM_LATENCY_ALLOC];
+	stats->import = drm->latency[DRM_LATENCY_IMPORT];
+	stats->lock = drm->latency[DRM_LATENCY_LOCK];
+	stats->post = drm->latency[DRM_LATENCY_POST];
+	stats->flip = drm->latency[DRM_LATENCY_FLIP];
+	if (reset)
+		memset(drm->latency, 0, sizeof(drm->latency));
+	pthread_mutex_unlock(&drm->stats_mutex);
+
+	pthread_mutex_lock(&drm->import_cache_mutex);
+	stats->cached_bos = drm->import_cache_count;
+	stats->cached_bytes = drm->import_cache_bytes;
+	stats->cache_hits = drm->import_cache_hits;
+	pthread_mutex_unlock(&drm->import_cache_mutex);
+}
+
+static void *gralloc_drm_lock_watchdog(void *arg)
+{
+	struct gralloc_drm_t *drm = (struct gralloc_drm_t *) arg;
+
+	pthread_mutex_lock(&drm->stats_mutex);
+	while (!drm->lock_watchdog_stop) {
+		int64_t now, threshold;
+		struct gralloc_drm_bo_t *bo;
+		struct timespec ts;
+
+		if (!drm->lock_watchdog_ms) {
+			pthread_cond_wait(&drm->lock_watchdog_cond,
+					&drm->stats_mutex);
+			continue;
+		}
+
+		now = gralloc_drm_get_time_ns();
+		threshold = (int64_t) drm->lock_watchdog_ms * 1000000;
+		for (bo = drm->locked_bos; bo; bo = bo->lock_next) {
+			if (bo->lock_reported || now - bo->lock_time < threshold)
+				continue;
+
+			ALOGW("bo %p (%dx%d format 0x%x usage 0x%x) locked by tid %d for %lld ms",
+					bo, bo->handle->width, bo->handle->height,
+					bo->handle->format, bo->locked_for,
+					bo->lock_tid,
+					(long long) ((now - bo->lock_time) / 1000000));
+			bo->lock_reported = 1;
+			drm->long_locks++;
+		}
+
+		/* look again in half a threshold */
+		clock_gettime(CLOCK_REALTIME, &ts);
+		threshold = ts.tv_nsec + threshold / 2;
+		ts.tv_sec += threshold / 1000000000;
+		ts.tv_nsec = threshold % 1000000000;
+		pthread_cond_timedwait(&drm->lock_watchdog_cond,
+				&drm->stats_mutex, &ts);
+	}
+	pthread_mutex_unlock(&drm->stats_mutex);
+
+	return NULL;
+}
+
+/*
+ * Log CPU locks held longer than the given time, or stop doing so when the
+ * time is 0.
+ */
+int gralloc_drm_set_lock_watchdog(struct gralloc_drm_t *drm, uint32_t ms)
+{
+	int err = 0;
+
+	pthread_mutex_lock(&drm->stats_mutex);
+	if (ms && !drm->lock_watchdog_started) {
+		err = -pthread_create(&drm->lock_watchdog, NULL,
+				gralloc_drm_lock_watchdog, drm);
+		if (err)
+			ALOGE("failed to start lock watchdog");
+		else
+			drm->lock_watchdog_started = 1;
+	}
+	if (!err) {
+		drm->lock_watchdog_ms = ms;
+		pthread_cond_signal(&drm->lock_watchdog_cond);
+	}
+	pthread_mutex_unlock(&drm->stats_mutex);
+
+	return err;
 }
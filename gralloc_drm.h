@@ -34,6 +34,9 @@ extern "C" {
 #ifndef MAX
 #define MAX(a, b) (((a) > (b)) ? (a) : (b))
 #endif
+#ifndef MIN
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#endif
 #define ALIGN(val, align) (((val) + (align) - 1) & ~((align) - 1))
 
 struct gralloc_drm_t;
@@ -45,8 +48,183 @@ enum {
 	GRALLOC_MODULE_PERFORM_AUTH_DRM_MAGIC            = 0x80000004,
 	GRALLOC_MODULE_PERFORM_ENTER_VT                  = 0x80000005,
 	GRALLOC_MODULE_PERFORM_LEAVE_VT                  = 0x80000006,
+	GRALLOC_MODULE_PERFORM_GET_ALLOC_STATS           = 0x40000007,
+	GRALLOC_MODULE_PERFORM_GET_BUFFER_ALLOC_INFO     = 0x40000008,
+	GRALLOC_MODULE_PERFORM_GET_KMS_CALIBRATION       = 0x40000009,
+	GRALLOC_MODULE_PERFORM_GET_DISPLAY_BANDWIDTH     = 0x4000000a,
+	GRALLOC_MODULE_PERFORM_GET_LOCK_STATS            = 0x4000000b,
+	GRALLOC_MODULE_PERFORM_SET_LOCK_WATCHDOG         = 0x8000000c,
+	GRALLOC_MODULE_PERFORM_GET_BUFFER_LOCK_INFO      = 0x4000000d,
+	GRALLOC_MODULE_PERFORM_GET_RESOURCE_STATS        = 0x4000000e,
+	GRALLOC_MODULE_PERFORM_GET_CRTC_CRC              = 0x4000000f,
+	GRALLOC_MODULE_PERFORM_GET_BUFFER_ID             = 0x40000010,
+	GRALLOC_MODULE_PERFORM_GET_BUFFER_GENERATION     = 0x40000011,
+	GRALLOC_MODULE_PERFORM_BUMP_BUFFER_GENERATION    = 0x80000012,
+	GRALLOC_MODULE_PERFORM_GET_BUFFER_METADATA       = 0x40000013,
+	GRALLOC_MODULE_PERFORM_SET_BUFFER_METADATA       = 0x80000014,
+	GRALLOC_MODULE_PERFORM_ALLOC_CONSTRAINED         = 0x80000015,
+	GRALLOC_MODULE_PERFORM_ALLOC_VIDEO_POOL          = 0x80000016,
+	GRALLOC_MODULE_PERFORM_ATTACH_FENCE              = 0x80000017,
+	GRALLOC_MODULE_PERFORM_SIGNAL_FENCE              = 0x80000018,
+	GRALLOC_MODULE_PERFORM_GET_QUOTA_STATS           = 0x40000019,
+	GRALLOC_MODULE_PERFORM_GET_PRESENT_FENCE         = 0x4000001a,
+	GRALLOC_MODULE_PERFORM_SET_PRESENT_ACQUIRE_FENCE = 0x8000001b,
+	GRALLOC_MODULE_PERFORM_GET_PIPE_SCREEN           = 0x4000001c,
+	GRALLOC_MODULE_PERFORM_SET_ALLOC_CLIENT          = 0x8000001d,
+};
+
+/* per-buffer metadata shared by all users of a buffer, and the data types */
+enum {
+	GRALLOC_DRM_METADATA_CROP,	/* struct gralloc_drm_rect */
+	GRALLOC_DRM_METADATA_DATASPACE,	/* int32_t, android_dataspace_t */
+	GRALLOC_DRM_METADATA_DAMAGE,	/* struct gralloc_drm_damage */
+	GRALLOC_DRM_METADATA_HDR,	/* struct gralloc_drm_hdr_metadata */
+	GRALLOC_DRM_METADATA_TIMESTAMP,	/* int64_t, in ns */
+
+	GRALLOC_DRM_METADATA_COUNT
+};
+
+struct gralloc_drm_rect {
+	int32_t left, top, right, bottom;
+};
+
+#define GRALLOC_DRM_MAX_DAMAGE_RECTS 16
+
+struct gralloc_drm_damage {
+	uint32_t num_rects;
+	struct gralloc_drm_rect rects[GRALLOC_DRM_MAX_DAMAGE_RECTS];
+};
+
+/* SMPTE ST 2086 and CTA 861.3, as in android_hdr_metadata */
+struct gralloc_drm_hdr_metadata {
+	float red[2], green[2], blue[2], white_point[2];
+	float max_luminance, min_luminance;
+	float max_content_light_level, max_frame_average_light_level;
+};
+
+/* layout requirements of one consumer of a buffer */
+struct gralloc_drm_constraints {
+	uint32_t stride_align;	/* in bytes, a power of two or 0 */
+	uint32_t offset_align;	/* of every plane, a power of two or 0 */
+	int linear;		/* tiled layouts are not understood */
+	int contiguous;		/* physically contiguous memory is needed */
+};
+
+/* bytes requested vs bytes allocated, for bos allocated by this process */
+struct gralloc_drm_alloc_stats {
+	uint32_t bo_count;
+	uint64_t requested_bytes; /* tightly packed sizes */
+	uint64_t allocated_bytes; /* real sizes, including all padding */
+};
+
+/*
+ * classes of local bos limited by quotas, see debug.drm.quota_*_mb; the
+ * limits apply to each client, see GRALLOC_MODULE_PERFORM_SET_ALLOC_CLIENT
+ */
+enum {
+	GRALLOC_DRM_QUOTA_TOTAL,	/* all of them */
+	GRALLOC_DRM_QUOTA_TEXTURE,	/* sampled only */
+	GRALLOC_DRM_QUOTA_RENDER,	/* rendered to by apps */
+	GRALLOC_DRM_QUOTA_VIDEO,	/* used by codecs or cameras */
+	GRALLOC_DRM_QUOTA_OTHER,	/* CPU only */
+	GRALLOC_DRM_QUOTA_DISPLAY,	/* scanned out, such as compositor targets */
+
+	GRALLOC_DRM_QUOTA_COUNT
+};
+
+struct gralloc_drm_quota_stats {
+	uint64_t limit[GRALLOC_DRM_QUOTA_COUNT]; /* in bytes, 0 for none */
+	uint64_t used[GRALLOC_DRM_QUOTA_COUNT];  /* by all clients */
+	uint32_t hits[GRALLOC_DRM_QUOTA_COUNT];  /* allocations refused */
+	uint32_t reclaims;	/* times cached memory was reclaimed */
+};
+
+#define GRALLOC_DRM_HISTOGRAM_BUCKETS 24
+
+/*
+ * A log2 histogram of durations.  Bucket 0 counts [0, 2) us, bucket i
+ * counts [2^i, 2^(i+1)) us and the last bucket counts everything above.
+ */
+struct gralloc_drm_histogram {
+	uint32_t count;
+	uint32_t buckets[GRALLOC_DRM_HISTOGRAM_BUCKETS];
+	uint64_t total_us;
+	uint64_t max_us;
+};
+
+/* CPU locks of bos, see GRALLOC_MODULE_PERFORM_SET_LOCK_WATCHDOG */
+struct gralloc_drm_lock_stats {
+	uint32_t locked_bos;	/* bos currently locked */
+	uint32_t long_locks;	/* locks caught by the watchdog */
+	uint32_t watchdog_ms;	/* watchdog threshold, 0 when disabled */
+	int oldest_tid;		/* holder of the oldest current lock */
+	uint64_t oldest_us;	/* age of the oldest current lock */
+	struct gralloc_drm_histogram hold; /* durations of released locks */
+};
+
+/* resources held by this process and latencies of the main operations */
+struct gralloc_drm_resource_stats {
+	uint32_t local_bos;	/* bos allocated by this process */
+	uint32_t imported_bos;	/* bos imported from other processes */
+	uint32_t fbs;		/* fb objects */
+	uint32_t fds;		/* open fds of the process */
+	uint64_t mapped_bytes;	/* bos currently mapped for CPU access */
+	struct gralloc_drm_histogram alloc;
+	struct gralloc_drm_histogram import;
+	struct gralloc_drm_histogram lock;
+	struct gralloc_drm_histogram post;
+	struct gralloc_drm_histogram flip; /* until the flip event */
+	uint32_t cached_bos;	/* unregistered imports kept for reuse */
+	uint32_t cache_hits;	/* imports served from the cache */
+	uint64_t cached_bytes;
+};
+
+/* outcome of the KMS calibration, see debug.drm.calibrate */
+struct gralloc_drm_kms_calibration {
+	int source;		/* 0: driver defaults, 1: measured, 2: cached */
+	int swap_mode;		/* the chosen enum drm_swap_mode */
+	int copy_engine;	/* the chosen enum drm_copy_engine */
+	uint32_t post_us[4];	/* average post time per swap mode, 0 if not tried */
+	uint32_t gpu_copy_mbps;	/* GPU blit throughput, 0 if not tried */
+	uint32_t cpu_copy_mbps;	/* CPU copy throughput, 0 if not tried */
+	uint32_t map_us;	/* time to map and unmap a front buffer */
 };
 
+/* estimated memory traffic of the display path, in bytes */
+struct gralloc_drm_bandwidth {
+	uint32_t refresh;	/* refresh rate of the primary output */
+	uint32_t frames;	/* frames posted since the last reset */
+	uint64_t scanout_bytes;	/* read by all CRTCs per refresh */
+	uint64_t plane_bytes;	/* part of scanout_bytes read for planes */
+	uint64_t clone_bytes;	/* clone blits, per frame */
+	uint64_t copy_bytes;	/* swap copies, per frame */
+	uint64_t map_bytes;	/* CPU reads and writes of mapped bos, per frame */
+	uint64_t frame_bytes;	/* all of the above, per frame */
+	uint64_t second_bytes;	/* per second when posting at the refresh rate */
+};
+
+/*
+ * Return an upper bound in us of a percentile of a histogram.
+ */
+static inline uint64_t gralloc_drm_histogram_percentile(
+		const struct gralloc_drm_histogram *hist, int percent)
+{
+	uint64_t target, seen = 0;
+	int i;
+
+	if (!hist->count)
+		return 0;
+
+	target = ((uint64_t) hist->count * percent + 99) / 100;
+	for (i = 0; i < GRALLOC_DRM_HISTOGRAM_BUCKETS - 1; i++) {
+		seen += hist->buckets[i];
+		if (seen >= target)
+			return MIN((uint64_t) 2 << i, hist->max_us);
+	}
+
+	return hist->max_us;
+}
+
 struct gralloc_drm_t *gralloc_drm_create(void);
 void gralloc_drm_destroy(struct gralloc_drm_t *drm);
 
@@ -62,15 +240,22 @@ int gralloc_drm_is_kms_initialized(struct gralloc_drm_t *drm);
 
 void gralloc_drm_get_kms_info(struct gralloc_drm_t *drm, struct framebuffer_device_t *fb);
 int gralloc_drm_is_kms_pipelined(struct gralloc_drm_t *drm);
+void gralloc_drm_get_kms_calibration(struct gralloc_drm_t *drm, struct gralloc_drm_kms_calibration *cal);
+int gralloc_drm_get_crtc_crc(struct gralloc_drm_t *drm, uint32_t *frame, uint32_t *crcs, int count);
+void gralloc_drm_get_bandwidth(struct gralloc_drm_t *drm, struct gralloc_drm_bandwidth *bw, int reset);
 
 static inline int gralloc_drm_get_bpp(int format)
 {
 	int bpp;
 
 	switch (format) {
+	case HAL_PIXEL_FORMAT_RGBA_FP16:
+		bpp = 8;
+		break;
 	case HAL_PIXEL_FORMAT_RGBA_8888:
 	case HAL_PIXEL_FORMAT_RGBX_8888:
 	case HAL_PIXEL_FORMAT_BGRA_8888:
+	case HAL_PIXEL_FORMAT_RGBA_1010102:
 		bpp = 4;
 		break;
 	case HAL_PIXEL_FORMAT_RGB_888:
@@ -78,8 +263,18 @@ static inline int gralloc_drm_get_bpp(int format)
 		break;
 	case HAL_PIXEL_FORMAT_RGB_565:
 	case HAL_PIXEL_FORMAT_YCbCr_422_I:
+	case HAL_PIXEL_FORMAT_Y16:
+	case HAL_PIXEL_FORMAT_RAW16:
+	case HAL_PIXEL_FORMAT_RAW_OPAQUE:
 		bpp = 2;
 		break;
+	case HAL_PIXEL_FORMAT_Y8:
+		bpp = 1;
+		break;
+	/* packed; see gralloc_drm_align_geometry */
+	case HAL_PIXEL_FORMAT_RAW10:
+		bpp = 1;
+		break;
 	/* planar; only Y is considered */
 	case HAL_PIXEL_FORMAT_YV12:
         case HAL_PIXEL_FORMAT_DRM_NV12:
@@ -88,6 +283,15 @@ static inline int gralloc_drm_get_bpp(int format)
 	case HAL_PIXEL_FORMAT_YCbCr_420_888:
 		bpp = 1;
 		break;
+	/* planar, 16 bits per sample */
+	case HAL_PIXEL_FORMAT_DRM_P010:
+	case HAL_PIXEL_FORMAT_DRM_P016:
+		bpp = 2;
+		break;
+	/* 1-D byte buffer; the width is the size in bytes */
+	case HAL_PIXEL_FORMAT_BLOB:
+		bpp = 1;
+		break;
 	default:
 		bpp = 0;
 		break;
@@ -101,12 +305,20 @@ static inline void gralloc_drm_align_geometry(int format, int *width, int *heigh
 	int align_w = 1, align_h = 1, extra_height_div = 0;
 
 	switch (format) {
-	case HAL_PIXEL_FORMAT_DRM_NV12:
 	case HAL_PIXEL_FORMAT_YV12:
+		/* chroma pitch is half of the luma pitch and must be 16-aligned */
 		align_w = 32;
 		align_h = 2;
 		extra_height_div = 2;
 		break;
+	case HAL_PIXEL_FORMAT_DRM_NV12:
+	case HAL_PIXEL_FORMAT_DRM_P010:
+	case HAL_PIXEL_FORMAT_DRM_P016:
+		/* chroma shares the luma pitch */
+		align_w = 2;
+		align_h = 2;
+		extra_height_div = 2;
+		break;
 	case HAL_PIXEL_FORMAT_YCbCr_422_SP:
 		align_w = 2;
 		extra_height_div = 1;
@@ -120,6 +332,18 @@ static inline void gralloc_drm_align_geometry(int format, int *width, int *heigh
 	case HAL_PIXEL_FORMAT_YCbCr_422_I:
 		align_w = 2;
 		break;
+	case HAL_PIXEL_FORMAT_Y8:
+	case HAL_PIXEL_FORMAT_Y16:
+	case HAL_PIXEL_FORMAT_RAW16:
+	case HAL_PIXEL_FORMAT_RAW_OPAQUE:
+		/* camera consumers expect the stride in multiples of 16 pixels */
+		align_w = 16;
+		break;
+	case HAL_PIXEL_FORMAT_RAW10:
+		/* 4 pixels are packed in 5 bytes; the width becomes the row size */
+		*width = ALIGN(*width, 4) * 5 / 4;
+		align_w = 16;
+		break;
 	}
 
 	*width = ALIGN(*width, align_w);
@@ -129,27 +353,123 @@ static inline void gralloc_drm_align_geometry(int format, int *width, int *heigh
 		*height += *height / extra_height_div;
 }
 
+struct gralloc_drm_plane_layout {
+	int num_planes;
+	uint32_t pitches[3];
+	uint32_t offsets[3];
+	uint32_t size;
+};
+
+/*
+ * Compute the per-plane layout of a buffer from the pitch and the number of
+ * rows of its first plane.  Planes are in the order of the matching DRM
+ * format and the chroma planes directly follow the luma plane.
+ */
+static inline void gralloc_drm_get_plane_layout(int format,
+		uint32_t pitch, int height, struct gralloc_drm_plane_layout *layout)
+{
+	uint32_t chroma_height = (height + 1) / 2;
+
+	layout->pitches[0] = pitch;
+	layout->offsets[0] = 0;
+
+	switch (format) {
+	case HAL_PIXEL_FORMAT_YV12:
+		/* like I420 but V comes before U */
+		layout->num_planes = 3;
+		layout->pitches[1] = pitch / 2;
+		layout->pitches[2] = pitch / 2;
+		layout->offsets[2] = pitch * height;
+		layout->offsets[1] = layout->offsets[2] +
+			layout->pitches[2] * chroma_height;
+		layout->size = layout->offsets[1] +
+			layout->pitches[1] * chroma_height;
+		break;
+	case HAL_PIXEL_FORMAT_DRM_NV12:
+	case HAL_PIXEL_FORMAT_DRM_P010:
+	case HAL_PIXEL_FORMAT_DRM_P016:
+	case HAL_PIXEL_FORMAT_YCrCb_420_SP:
+	case HAL_PIXEL_FORMAT_YCbCr_420_888:
+		/* U and V are interleaved in the 2nd plane */
+		layout->num_planes = 2;
+		layout->pitches[1] = pitch;
+		layout->offsets[1] = pitch * height;
+		layout->size = layout->offsets[1] + pitch * chroma_height;
+		break;
+	case HAL_PIXEL_FORMAT_YCbCr_422_SP:
+		layout->num_planes = 2;
+		layout->pitches[1] = pitch;
+		layout->offsets[1] = pitch * height;
+		layout->size = layout->offsets[1] + pitch * height;
+		break;
+	default:
+		layout->num_planes = 1;
+		layout->size = pitch * height;
+		break;
+	}
+}
+
+/*
+ * Return the size of a buffer whose planes are tightly packed, that is,
+ * the size it would have without any alignment or padding.
+ */
+static inline uint32_t gralloc_drm_get_tight_size(int format,
+		int width, int height)
+{
+	struct gralloc_drm_plane_layout layout;
+	uint32_t pitch;
+
+	if (format == HAL_PIXEL_FORMAT_RAW10)
+		pitch = (width * 10 + 7) / 8;
+	else
+		pitch = width * gralloc_drm_get_bpp(format);
+
+	gralloc_drm_get_plane_layout(format, pitch, height, &layout);
+
+	return layout.size;
+}
+
 int gralloc_drm_handle_register(buffer_handle_t handle, struct gralloc_drm_t *drm);
 int gralloc_drm_handle_unregister(buffer_handle_t handle);
 
 struct gralloc_drm_bo_t *gralloc_drm_bo_create(struct gralloc_drm_t *drm, int width, int height, int format, int usage);
+int gralloc_drm_merge_constraints(const struct gralloc_drm_constraints *list, int count, struct gralloc_drm_constraints *merged);
+struct gralloc_drm_bo_t *gralloc_drm_bo_create_constrained(struct gralloc_drm_t *drm, int width, int height, int format, int usage, const struct gralloc_drm_constraints *constraints);
 void gralloc_drm_bo_decref(struct gralloc_drm_bo_t *bo);
 
 struct gralloc_drm_bo_t *gralloc_drm_bo_from_handle(buffer_handle_t handle);
 buffer_handle_t gralloc_drm_bo_get_handle(struct gralloc_drm_bo_t *bo, int *stride);
 int gralloc_drm_get_prime_fd(buffer_handle_t _handle);
 int gralloc_drm_get_gem_handle(buffer_handle_t handle);
+void gralloc_drm_bo_get_alloc_info(const struct gralloc_drm_bo_t *bo, uint64_t *requested, uint64_t *allocated);
+void gralloc_drm_get_alloc_stats(struct gralloc_drm_t *drm, struct gralloc_drm_alloc_stats *stats);
+void gralloc_drm_get_quota_stats(struct gralloc_drm_t *drm, struct gralloc_drm_quota_stats *stats);
+void gralloc_drm_set_alloc_client(int pid);
+void gralloc_drm_bo_get_lock_info(struct gralloc_drm_bo_t *bo, int *tid, uint64_t *held_us);
+void gralloc_drm_get_lock_stats(struct gralloc_drm_t *drm, struct gralloc_drm_lock_stats *stats);
+int gralloc_drm_set_lock_watchdog(struct gralloc_drm_t *drm, uint32_t ms);
+void gralloc_drm_get_resource_stats(struct gralloc_drm_t *drm, struct gralloc_drm_resource_stats *stats, int reset);
 void gralloc_drm_resolve_format(buffer_handle_t _handle, uint32_t *pitches, uint32_t *offsets, uint32_t *handles);
 unsigned int planes_for_format(struct gralloc_drm_t *drm, int hal_format);
 
 int gralloc_drm_bo_lock(struct gralloc_drm_bo_t *bo, int x, int y, int w, int h, int enable_write, void **addr);
 void gralloc_drm_bo_unlock(struct gralloc_drm_bo_t *bo);
+uint32_t gralloc_drm_bo_get_generation(struct gralloc_drm_bo_t *bo);
+void gralloc_drm_bo_bump_generation(struct gralloc_drm_bo_t *bo);
+int gralloc_drm_bo_get_metadata(struct gralloc_drm_bo_t *bo, int type, void *data, size_t size);
+int gralloc_drm_bo_set_metadata(struct gralloc_drm_bo_t *bo, int type, const void *data, size_t size);
+int gralloc_drm_bo_attach_fence(struct gralloc_drm_bo_t *bo, int write, uint32_t *fence);
+int gralloc_drm_signal_fence(struct gralloc_drm_t *drm, uint32_t fence);
+int gralloc_drm_get_pipe_screen(struct gralloc_drm_t *drm, void **screen);
 
 int gralloc_drm_bo_need_fb(const struct gralloc_drm_bo_t *bo);
 int gralloc_drm_bo_add_fb(struct gralloc_drm_bo_t *bo);
 void gralloc_drm_bo_rm_fb(struct gralloc_drm_bo_t *bo);
 int gralloc_drm_bo_post(struct gralloc_drm_bo_t *bo);
+int gralloc_drm_get_present_fence(struct gralloc_drm_t *drm);
+void gralloc_drm_set_present_acquire_fence(struct gralloc_drm_t *drm, int fence);
 
+int gralloc_drm_alloc_video_pool(struct gralloc_drm_t *drm, int width, int height, int format, int usage, int count, struct gralloc_drm_bo_t **bos);
 int gralloc_drm_reserve_plane(struct gralloc_drm_t *drm,
 	buffer_handle_t handle, uint32_t id,
 	uint32_t dst_x, uint32_t dst_y, uint32_t dst_w, uint32_t dst_h,
@@ -0,0 +1,500 @@
+/*
+ * Copyright (C) 2010-2011 Chia-I Wu <olvaffe@gmail.com>
+ * Copyright (C) 2010-2011 LunarG Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * A driver for KMS-only devices, such as vkms, that only have dumb buffers.
+ * Everything is done by the CPU.
+ *
+ * It also drives vgem, which adds PRIME and fences without a GPU.  There,
+ * CPU access waits for the fences of a bo like a GPU driver would make it.
+ */
+
+#define LOG_TAG "GRALLOC-DUMB"
+
+#include <cutils/log.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <drm.h>
+
+#include "gralloc_drm.h"
+#include "gralloc_drm_priv.h"
+
+/* from vgem_drm.h, which is not always installed */
+struct vgem_fence_attach {
+	uint32_t handle;
+	uint32_t flags;
+#define VGEM_FENCE_WRITE 0x1
+	uint32_t out_fence;
+	uint32_t pad;
+};
+
+struct vgem_fence_signal {
+	uint32_t fence;
+	uint32_t flags;
+};
+
+#define VGEM_IOCTL_FENCE_ATTACH \
+	DRM_IOWR(DRM_COMMAND_BASE + 0x1, struct vgem_fence_attach)
+#define VGEM_IOCTL_FENCE_SIGNAL \
+	DRM_IOW(DRM_COMMAND_BASE + 0x2, struct vgem_fence_signal)
+
+/* from linux/dma-buf.h */
+struct dumb_dma_buf_sync {
+	uint64_t flags;
+};
+
+#define DUMB_DMA_BUF_SYNC_READ  (1 << 0)
+#define DUMB_DMA_BUF_SYNC_WRITE (2 << 0)
+#define DUMB_DMA_BUF_SYNC_START (0 << 2)
+#define DUMB_DMA_BUF_SYNC_END   (1 << 2)
+#define DUMB_DMA_BUF_IOCTL_SYNC _IOW('b', 0, struct dumb_dma_buf_sync)
+
+struct dumb_info {
+	struct gralloc_drm_drv_t base;
+
+	int fd;
+	int fences; /* vgem fences may be attached to the bos */
+};
+
+struct dumb_buffer {
+	struct gralloc_drm_bo_t base;
+
+	uint32_t handle;
+	void *addr; /* mapped on first use */
+
+	/* for implicit sync of CPU access when there are fences */
+	int prime_fd;
+	uint64_t sync_flags; /* of the current CPU access */
+};
+
+static int create_dumb(struct dumb_info *info,
+		struct gralloc_drm_handle_t *handle,
+		const struct gralloc_drm_constraints *constraints,
+		struct dumb_buffer *db)
+{
+	struct drm_mode_create_dumb create;
+	struct gralloc_drm_plane_layout layout;
+	struct drm_gem_flink flink;
+	int width, height, cpp;
+
+	cpp = gralloc_drm_get_bpp(handle->format);
+
+	width = handle->width;
+	height = handle->height;
+	gralloc_drm_align_geometry(handle->format, &width, &height);
+	width = gralloc_drm_constrain_width(constraints, cpp, width);
+
+	/*
+	 * Allocate the rows of all the planes.  The chroma pitches scale with
+	 * the luma pitch, so the row count holds for any pitch the kernel
+	 * picks.
+	 */
+	gralloc_drm_get_plane_layout(handle->format, width * cpp,
+			handle->height, &layout);
+	height = (layout.size + width * cpp - 1) / (width * cpp);
+
+	memset(&create, 0, sizeof(create));
+	create.width = width;
+	create.height = height;
+	create.bpp = cpp * 8;
+	if (drmIoctl(info->fd, DRM_IOCTL_MODE_CREATE_DUMB, &create)) {
+		ALOGE("failed to create dumb buffer %dx%dx%d",
+				width, height, cpp);
+		return -errno;
+	}
+
+	memset(&flink, 0, sizeof(flink));
+	flink.handle = create.handle;
+	if (drmIoctl(info->fd, DRM_IOCTL_GEM_FLINK, &flink)) {
+		struct drm_mode_destroy_dumb destroy;
+		int err = -errno;
+
+		ALOGE("failed to flink dumb buffer");
+		memset(&destroy, 0, sizeof(destroy));
+		destroy.handle = create.handle;
+		drmIoctl(info->fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy);
+
+		return err;
+	}
+
+	db->handle = create.handle;
+	db->base.size = create.size;
+	handle->name = flink.name;
+	handle->stride = create.pitch;
+
+	return 0;
+}
+
+static int open_dumb(struct dumb_info *info,
+		struct gralloc_drm_handle_t *handle, struct dumb_buffer *db)
+{
+	struct drm_gem_open open_arg;
+
+	memset(&open_arg, 0, sizeof(open_arg));
+	open_arg.name = handle->name;
+	if (drmIoctl(info->fd, DRM_IOCTL_GEM_OPEN, &open_arg)) {
+		ALOGE("failed to open dumb buffer from name %u",
+				handle->name);
+		return -errno;
+	}
+
+	db->handle = open_arg.handle;
+	db->base.size = open_arg.size;
+
+	return 0;
+}
+
+static struct gralloc_drm_bo_t *
+dumb_alloc(struct gralloc_drm_drv_t *drv, struct gralloc_drm_handle_t *handle,
+		const struct gralloc_drm_constraints *constraints)
+{
+	struct dumb_info *info = (struct dumb_info *) drv;
+	struct dumb_buffer *db;
+	int err;
+
+	if (!gralloc_drm_get_bpp(handle->format)) {
+		ALOGE("unrecognized format 0x%x", handle->format);
+		return NULL;
+	}
+
+	/* dumb buffers are always linear, but may be scattered */
+	if (constraints && constraints->contiguous) {
+		ALOGE("contiguous bos are not supported");
+		return NULL;
+	}
+
+	db = calloc(1, sizeof(*db));
+	if (!db)
+		return NULL;
+
+	if (handle->name)
+		err = open_dumb(info, handle, db);
+	else
+		err = create_dumb(info, handle, constraints, db);
+	if (err) {
+		free(db);
+		return NULL;
+	}
+
+	/* older kernels do not allow DRM_RDWR */
+	db->prime_fd = -1;
+	if (info->fences &&
+	    drmPrimeHandleToFD(info->fd, db->handle,
+				DRM_CLOEXEC | DRM_RDWR, &db->prime_fd) &&
+	    drmPrimeHandleToFD(info->fd, db->handle,
+				DRM_CLOEXEC, &db->prime_fd)) {
+		ALOGW("failed to export dumb buffer, CPU access will not be synced");
+		db->prime_fd = -1;
+	}
+
+	/* every dumb buffer can be scanned out */
+	db->base.fb_handle = db->handle;
+	db->base.handle = handle;
+
+	return &db->base;
+}
+
+static void dumb_free(struct gralloc_drm_drv_t *drv,
+		struct gralloc_drm_bo_t *bo)
+{
+	struct dumb_info *info = (struct dumb_info *) drv;
+	struct dumb_buffer *db = (struct dumb_buffer *) bo;
+	struct drm_gem_close close_arg;
+
+	if (db->addr)
+		munmap(db->addr, db->base.size);
+	if (db->prime_fd >= 0)
+		close(db->prime_fd);
+
+	/* also destroys the dumb buffer with the last reference */
+	memset(&close_arg, 0, sizeof(close_arg));
+	close_arg.handle = db->handle;
+	drmIoctl(info->fd, DRM_IOCTL_GEM_CLOSE, &close_arg);
+
+	free(db);
+}
+
+static int dumb_map(struct gralloc_drm_drv_t *drv,
+		struct gralloc_drm_bo_t *bo, int x, int y, int w, int h,
+		int enable_write, void **addr)
+{
+	struct dumb_info *info = (struct dumb_info *) drv;
+	struct dumb_buffer *db = (struct dumb_buffer *) bo;
+
+	if (!db->addr) {
+		struct drm_mode_map_dumb map;
+		void *ptr;
+
+		memset(&map, 0, sizeof(map));
+		map.handle = db->handle;
+		if (drmIoctl(info->fd, DRM_IOCTL_MODE_MAP_DUMB, &map))
+			return -errno;
+
+		ptr = mmap(NULL, db->base.size, PROT_READ | PROT_WRITE,
+				MAP_SHARED, info->fd, map.offset);
+		if (ptr == MAP_FAILED)
+			return -errno;
+
+		db->addr = ptr;
+	}
+
+	/* wait for the fences, reads only wait for the writer */
+	if (db->prime_fd >= 0) {
+		struct dumb_dma_buf_sync sync;
+
+		db->sync_flags = DUMB_DMA_BUF_SYNC_READ;
+		if (enable_write)
+			db->sync_flags |= DUMB_DMA_BUF_SYNC_WRITE;
+
+		sync.flags = DUMB_DMA_BUF_SYNC_START | db->sync_flags;
+		if (ioctl(db->prime_fd, DUMB_DMA_BUF_IOCTL_SYNC, &sync))
+			ALOGW("failed to begin CPU access (%s)",
+					strerror(errno));
+	}
+
+	*addr = db->addr;
+
+	return 0;
+}
+
+static void dumb_unmap(struct gralloc_drm_drv_t *drv,
+		struct gralloc_drm_bo_t *bo)
+{
+	struct dumb_buffer *db = (struct dumb_buffer *) bo;
+
+	/* keep the mapping until the bo is freed */
+	if (db->prime_fd >= 0 && db->sync_flags) {
+		struct dumb_dma_buf_sync sync;
+
+		sync.flags = DUMB_DMA_BUF_SYNC_END | db->sync_flags;
+		ioctl(db->prime_fd, DUMB_DMA_BUF_IOCTL_SYNC, &sync);
+		db->sync_flags = 0;
+	}
+}
+
+static int dumb_attach_fence(struct gralloc_drm_drv_t *drv,
+		struct gralloc_drm_bo_t *bo, int write, uint32_t *fence)
+{
+	struct dumb_info *info = (struct dumb_info *) drv;
+	struct dumb_buffer *db = (struct dumb_buffer *) bo;
+	struct vgem_fence_attach attach;
+
+	memset(&attach, 0, sizeof(attach));
+	attach.handle = db->handle;
+	attach.flags = (write) ? VGEM_FENCE_WRITE : 0;
+	if (drmIoctl(info->fd, VGEM_IOCTL_FENCE_ATTACH, &attach))
+		return -errno;
+
+	*fence = attach.out_fence;
+
+	return 0;
+}
+
+static int dumb_signal_fence(struct gralloc_drm_drv_t *drv, uint32_t fence)
+{
+	struct dumb_info *info = (struct dumb_info *) drv;
+	struct vgem_fence_signal signal;
+
+	memset(&signal, 0, sizeof(signal));
+	signal.fence = fence;
+	if (drmIoctl(info->fd, VGEM_IOCTL_FENCE_SIGNAL, &signal))
+		return -errno;
+
+	return 0;
+}
+
+static void dumb_blit(struct gralloc_drm_drv_t *drv,
+		struct gralloc_drm_bo_t *dst,
+		struct gralloc_drm_bo_t *src,
+		uint16_t dst_x1, uint16_t dst_y1,
+		uint16_t dst_x2, uint16_t dst_y2,
+		uint16_t src_x1, uint16_t src_y1,
+		uint16_t src_x2, uint16_t src_y2)
+{
+	int cpp = gralloc_drm_get_bpp(dst->handle->format);
+	char *dst_addr, *src_addr;
+	int width, height, y;
+
+	if (!cpp || cpp != gralloc_drm_get_bpp(src->handle->format)) {
+		ALOGE("blit between incompatible formats 0x%x and 0x%x",
+				dst->handle->format, src->handle->format);
+		return;
+	}
+
+	dst_x2 = MIN(dst_x2, dst->handle->width);
+	dst_y2 = MIN(dst_y2, dst->handle->height);
+	src_x2 = MIN(src_x2, src->handle->width);
+	src_y2 = MIN(src_y2, src->handle->height);
+
+	width = MIN(dst_x2 - dst_x1, src_x2 - src_x1);
+	height = MIN(dst_y2 - dst_y1, src_y2 - src_y1);
+	if (width <= 0 || height <= 0)
+		return;
+
+	if (dumb_map(drv, src, 0, 0, 0, 0, 0, (void **) &src_addr))
+		return;
+	if (dumb_map(drv, dst, 0, 0, 0, 0, 1, (void **) &dst_addr)) {
+		dumb_unmap(drv, src);
+		return;
+	}
+
+	src_addr += src_y1 * src->handle->stride + src_x1 * cpp;
+	dst_addr += dst_y1 * dst->handle->stride + dst_x1 * cpp;
+	for (y = 0; y < height; y++) {
+		memcpy(dst_addr, src_addr, width * cpp);
+		src_addr += src->handle->stride;
+		dst_addr += dst->handle->stride;
+	}
+
+	dumb_unmap(drv, src);
+	dumb_unmap(drv, dst);
+}
+
+static void dumb_resolve_format(struct gralloc_drm_drv_t *drv,
+		struct gralloc_drm_bo_t *bo,
+		uint32_t *pitches, uint32_t *offsets, uint32_t *handles)
+{
+	struct gralloc_drm_plane_layout layout;
+	int i;
+
+	memset(pitches, 0, 4 * sizeof(uint32_t));
+	memset(offsets, 0, 4 * sizeof(uint32_t));
+	memset(handles, 0, 4 * sizeof(uint32_t));
+
+	gralloc_drm_get_plane_layout(bo->handle->format,
+			bo->handle->stride, bo->handle->height, &layout);
+
+	for (i = 0; i < layout.num_planes; i++) {
+		pitches[i] = layout.pitches[i];
+		offsets[i] = layout.offsets[i];
+		handles[i] = bo->fb_handle;
+	}
+}
+
+static void dumb_init_kms_features(struct gralloc_drm_drv_t *drv,
+		struct gralloc_drm_t *drm)
+{
+	switch (drm->primary->fb_format) {
+	case HAL_PIXEL_FORMAT_RGBA_8888:
+	case HAL_PIXEL_FORMAT_BGRA_8888:
+	case HAL_PIXEL_FORMAT_RGB_565:
+		break;
+	default:
+		drm->primary->fb_format = HAL_PIXEL_FORMAT_BGRA_8888;
+		break;
+	}
+
+	drm->mode_quirk_vmwgfx = 0;
+	drm->swap_mode = DRM_SWAP_FLIP;
+	drm->mode_sync_flip = 1;
+	drm->swap_interval = 1;
+	drm->vblank_secondary = 0;
+}
+
+static void dumb_destroy(struct gralloc_drm_drv_t *drv)
+{
+	struct dumb_info *info = (struct dumb_info *) drv;
+	free(info);
+}
+
+/*
+ * Check that dumb buffers can be created.  The cap is only reported by KMS
+ * drivers, so a device without KMS is probed with a 1x1 buffer instead.
+ */
+static int has_dumb_buffers(int fd, int kms)
+{
+	struct drm_mode_create_dumb create;
+	struct drm_mode_destroy_dumb destroy;
+	uint64_t has_dumb = 0;
+
+	if (kms)
+		return (!drmGetCap(fd, DRM_CAP_DUMB_BUFFER, &has_dumb) && has_dumb);
+
+	memset(&create, 0, sizeof(create));
+	create.width = 1;
+	create.height = 1;
+	create.bpp = 32;
+	if (drmIoctl(fd, DRM_IOCTL_MODE_CREATE_DUMB, &create))
+		return 0;
+
+	memset(&destroy, 0, sizeof(destroy));
+	destroy.handle = create.handle;
+	drmIoctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy);
+
+	return 1;
+}
+
+static struct dumb_info *create_dumb_info(int fd, int kms)
+{
+	struct dumb_info *info;
+
+	if (!has_dumb_buffers(fd, kms)) {
+		ALOGE("no dumb buffer support");
+		return NULL;
+	}
+
+	info = calloc(1, sizeof(*info));
+	if (!info)
+		return NULL;
+
+	info->fd = fd;
+
+	info->base.destroy = dumb_destroy;
+	info->base.init_kms_features = dumb_init_kms_features;
+	info->base.alloc = dumb_alloc;
+	info->base.free = dumb_free;
+	info->base.map = dumb_map;
+	info->base.unmap = dumb_unmap;
+	info->base.blit = dumb_blit;
+	info->base.resolve_format = dumb_resolve_format;
+
+	return info;
+}
+
+struct gralloc_drm_drv_t *gralloc_drm_drv_create_for_dumb(int fd)
+{
+	struct dumb_info *info = create_dumb_info(fd, 1);
+
+	return (info) ? &info->base : NULL;
+}
+
+/*
+ * Create the driver for vgem, which has no KMS but has fences.
+ */
+struct gralloc_drm_drv_t *gralloc_drm_drv_create_for_vgem(int fd)
+{
+	struct dumb_info *info = create_dumb_info(fd, 0);
+
+	if (!info)
+		return NULL;
+
+	info->fences = 1;
+	info->base.attach_fence = dumb_attach_fence;
+	info->base.signal_fence = dumb_signal_fence;
+
+	return &info->base;
+}
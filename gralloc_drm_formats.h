@@ -29,6 +29,9 @@ extern "C" {
 enum {
 
 	HAL_PIXEL_FORMAT_DRM_NV12 = 0x102,
+	/* same value as HAL_PIXEL_FORMAT_YCBCR_P010 of newer platforms */
+	HAL_PIXEL_FORMAT_DRM_P010 = 0x36,
+	HAL_PIXEL_FORMAT_DRM_P016 = 0x103,
 };
 
 #ifdef __cplusplus
@@ -66,8 +66,20 @@ static struct fd_bo *alloc_bo(struct fd_info *info,
 	return fd_bo_new(info->dev, size, flags);
 }
 
+/*
+ * Allocate a linear byte buffer that the CPU maps cached.
+ */
+static struct fd_bo *alloc_blob(struct fd_info *info, int size, int *pitch)
+{
+	*pitch = size;
+
+	return fd_bo_new(info->dev, ALIGN(size, 4096),
+			DRM_FREEDRENO_GEM_CACHE_WBACK);
+}
+
 static struct gralloc_drm_bo_t *
-fd_alloc(struct gralloc_drm_drv_t *drv, struct gralloc_drm_handle_t *handle)
+fd_alloc(struct gralloc_drm_drv_t *drv, struct gralloc_drm_handle_t *handle,
+		const struct gralloc_drm_constraints *constraints)
 {
 	struct fd_info *info = (struct fd_info *) drv;
 	struct fd_buffer *fd_buf;
@@ -98,9 +110,20 @@ fd_alloc(struct gralloc_drm_drv_t *drv, struct gralloc_drm_handle_t *handle)
 		width = handle->width;
 		height = handle->height;
 		gralloc_drm_align_geometry(handle->format, &width, &height);
+		width = gralloc_drm_constrain_width(constraints, cpp, width);
 
-		fd_buf->bo = alloc_bo(info, width, height,
-				cpp, handle->usage, &pitch);
+		/* there is no way to ask for contiguous memory */
+		if (constraints && constraints->contiguous) {
+			ALOGE("contiguous bos are not supported");
+			free(fd_buf);
+			return NULL;
+		}
+
+		if (handle->format == HAL_PIXEL_FORMAT_BLOB)
+			fd_buf->bo = alloc_blob(info, width * height, &pitch);
+		else
+			fd_buf->bo = alloc_bo(info, width, height,
+					cpp, handle->usage, &pitch);
 		if (!fd_buf->bo) {
 			ALOGE("failed to allocate fd bo %dx%dx%d",
 					handle->width, handle->height, cpp);
@@ -120,6 +143,7 @@ fd_alloc(struct gralloc_drm_drv_t *drv, struct gralloc_drm_handle_t *handle)
 
 	if (handle->usage & GRALLOC_USAGE_HW_FB)
 		fd_buf->base.fb_handle = fd_bo_handle(fd_buf->bo);
+	fd_buf->base.size = fd_bo_size(fd_buf->bo);
 
 	fd_buf->base.handle = handle;
 
@@ -139,7 +163,9 @@ static int fd_map(struct gralloc_drm_drv_t *drv,
 		int enable_write, void **addr)
 {
 	struct fd_buffer *fd_buf = (struct fd_buffer *) bo;
-	if (fd_bo_map(fd_buf->bo))
+
+	*addr = fd_bo_map(fd_buf->bo);
+	if (*addr)
 		return 0;
 	return -errno;
 }
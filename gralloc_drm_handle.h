@@ -37,6 +37,8 @@ struct gralloc_drm_handle_t {
 	native_handle_t base;
 
 	/* file descriptors */
+	int shared_fd; /* ashmem page shared by all users of the bo */
+
 	int prime_fd;
 
 	int magic;
@@ -51,6 +53,13 @@ struct gralloc_drm_handle_t {
 	int name;   /* the name of the bo */
 	int stride; /* the stride in bytes */
 
+	/*
+	 * with the pid of the allocating process, not reused within a boot,
+	 * unlike names, see gralloc_drm_new_id
+	 */
+	uint64_t id __attribute__((aligned(8)));
+	int id_pid;
+
 	int data_owner; /* owner of data (for validation) */
 	union {
 		struct gralloc_drm_bo_t *data; /* pointer to struct gralloc_drm_bo_t */
@@ -59,7 +68,7 @@ struct gralloc_drm_handle_t {
 };
 
 #define GRALLOC_DRM_HANDLE_MAGIC 0x12345678
-#define GRALLOC_DRM_HANDLE_NUM_FDS 0
+#define GRALLOC_DRM_HANDLE_NUM_FDS 1
 #define GRALLOC_DRM_HANDLE_NUM_INTS (						\
 	((sizeof(struct gralloc_drm_handle_t) - sizeof(native_handle_t))/sizeof(int))	\
 	 - GRALLOC_DRM_HANDLE_NUM_FDS)
@@ -30,13 +30,16 @@
 #define LOG_TAG "GRALLOC-I915"
 
 #include <cutils/log.h>
+#include <cutils/properties.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
 #include <assert.h>
 #include <drm.h>
 #include <intel_bufmgr.h>
 #include <i915_drm.h>
+#include <drm_fourcc.h>
 
 #include "gralloc_drm.h"
 #include "gralloc_drm_priv.h"
@@ -52,6 +55,15 @@
 #define XY_SRC_COPY_BLT_WRITE_RGB   (1 << 20)
 #define XY_SRC_COPY_BLT_SRC_TILED   (1 << 15)
 #define XY_SRC_COPY_BLT_DST_TILED   (1 << 11)
+#define MI_LOAD_REGISTER_IMM        (0x22 << 23)
+#define BCS_SWCTRL                  0x22200
+#define BCS_SWCTRL_SRC_Y            (1 << 0)
+#define BCS_SWCTRL_DST_Y            (1 << 1)
+
+/* older drm_fourcc.h */
+#ifndef I915_FORMAT_MOD_Y_TILED
+#define I915_FORMAT_MOD_Y_TILED fourcc_mod_code(INTEL, 2)
+#endif
 
 #define DEBUG_BLT 0
 
@@ -66,12 +78,21 @@ struct intel_info {
 	uint32_t *batch, *cur;
 	int capacity, size;
 	int exec_blt;
+	int has_exec_fence;
+	int map_wc;
+};
+
+enum intel_map_mode {
+	INTEL_MAP_CPU,	/* cached, snooped or clflushed */
+	INTEL_MAP_WC,	/* write-combined CPU mapping */
+	INTEL_MAP_GTT,	/* through the aperture, detiled by the fence */
 };
 
 struct intel_buffer {
 	struct gralloc_drm_bo_t base;
 	drm_intel_bo *ibo;
 	uint32_t tiling;
+	enum intel_map_mode map_mode;
 };
 
 static int
@@ -134,8 +155,12 @@ batch_reloc64(struct intel_info *info, struct gralloc_drm_bo_t *bo,
 	return ret;
 }
 
+/*
+ * Submit the batch.  Wait on in_fence when it is not -1, and return a
+ * sync_file signaled on completion in out_fence when it is not NULL.
+ */
 static int
-batch_flush(struct intel_info *info)
+batch_flush_fenced(struct intel_info *info, int in_fence, int *out_fence)
 {
 	int size, ret;
 
@@ -152,8 +177,12 @@ batch_flush(struct intel_info *info)
 		ALOGE("failed to subdata batch");
 		goto fail;
 	}
-	ret = drm_intel_bo_mrb_exec(info->batch_ibo, size,
-		NULL, 0, 0, info->exec_blt);
+	if (in_fence >= 0 || out_fence)
+		ret = drm_intel_gem_bo_fence_exec(info->batch_ibo, NULL, size,
+			in_fence, out_fence, info->exec_blt);
+	else
+		ret = drm_intel_bo_mrb_exec(info->batch_ibo, size,
+			NULL, 0, 0, info->exec_blt);
 	if (ret) {
 		ALOGE("failed to exec batch");
 		goto fail;
@@ -167,6 +196,12 @@ fail:
 	return ret;
 }
 
+static int
+batch_flush(struct intel_info *info)
+{
+	return batch_flush_fenced(info, -1, NULL);
+}
+
 static int
 batch_reserve(struct intel_info *info, int count)
 {
@@ -223,44 +258,47 @@ static void intel_resolve_format(struct gralloc_drm_drv_t *drv,
 	 */
 
 	struct intel_buffer *ib = (struct intel_buffer *) bo;
+	struct gralloc_drm_plane_layout layout;
+	int i;
 
 	memset(pitches, 0, 4 * sizeof(uint32_t));
 	memset(offsets, 0, 4 * sizeof(uint32_t));
 	memset(handles, 0, 4 * sizeof(uint32_t));
 
-	pitches[0] = ib->base.handle->stride;
-	handles[0] = ib->base.fb_handle;
-
-	switch(ib->base.handle->format) {
-		case HAL_PIXEL_FORMAT_YV12:
-
-			// U and V stride are half of Y plane
-			pitches[2] = pitches[0]/2;
-			pitches[1] = pitches[0]/2;
+	gralloc_drm_get_plane_layout(ib->base.handle->format,
+			ib->base.handle->stride, ib->base.handle->height,
+			&layout);
 
-			// like I420 but U and V are in reverse order
-			offsets[2] = offsets[0] +
-				pitches[0] * ib->base.handle->height;
-			offsets[1] = offsets[2] +
-				pitches[2] * ib->base.handle->height/2;
+	for (i = 0; i < layout.num_planes; i++) {
+		pitches[i] = layout.pitches[i];
+		offsets[i] = layout.offsets[i];
+		handles[i] = ib->base.fb_handle;
+	}
+}
 
-			handles[1] = handles[2] = handles[0];
-			break;
 
-		case HAL_PIXEL_FORMAT_DRM_NV12:
+/*
+ * Select Y-major tiling of the BLT source and destination.  BCS_SWCTRL
+ * must be written after the previous blits have completed.
+ */
+static void batch_swctrl(struct intel_info *info, uint32_t bits)
+{
+	int n = (info->gen >= 80) ? 5 : 4;
+	int i;
 
-			// U and V are interleaved in 2nd plane
-			pitches[1] = pitches[0];
-			offsets[1] = offsets[0] +
-				pitches[0] * ib->base.handle->height;
+	batch_dword(info, MI_FLUSH_DW | (n - 2));
+	for (i = 1; i < n; i++)
+		batch_dword(info, 0);
 
-			handles[1] = handles[0];
-			break;
-	}
+	batch_dword(info, MI_LOAD_REGISTER_IMM | 1);
+	batch_dword(info, BCS_SWCTRL);
+	batch_dword(info, ((BCS_SWCTRL_SRC_Y | BCS_SWCTRL_DST_Y) << 16) | bits);
 }
 
-
-static void intel_blit(struct gralloc_drm_drv_t *drv,
+/*
+ * Emit a blit to the batch.  Return 1 when there is nothing to blit.
+ */
+static int intel_emit_blit(struct intel_info *info,
 		struct gralloc_drm_bo_t *dst,
 		struct gralloc_drm_bo_t *src,
 		uint16_t dst_x1, uint16_t dst_y1,
@@ -268,11 +306,10 @@ static void intel_blit(struct gralloc_drm_drv_t *drv,
 		uint16_t src_x1, uint16_t src_y1,
 		uint16_t src_x2, uint16_t src_y2)
 {
-	struct intel_info *info = (struct intel_info *) drv;
 	struct intel_buffer *dst_ib = (struct intel_buffer *) dst;
 	struct intel_buffer *src_ib = (struct intel_buffer *) src;
 	drm_intel_bo *bo_table[3];
-	uint32_t cmd, br13, dst_pitch, src_pitch;
+	uint32_t cmd, br13, dst_pitch, src_pitch, swctrl;
 
 	/*
 	 * XY_SRC_COPY_BLT_CMD does not support scaling,
@@ -281,17 +318,17 @@ static void intel_blit(struct gralloc_drm_drv_t *drv,
 	if (src_x2 - src_x1 != dst_x2 - dst_x1 ||
 		src_y2 - src_y1 != dst_y2 - dst_y1) {
 		ALOGE("%s, src and dst rect must match", __func__);
-		return;
+		return -EINVAL;
 	}
 
 	if (dst->handle->format != src->handle->format) {
 		ALOGE("%s, src and dst format must match", __func__);
-		return;
+		return -EINVAL;
 	}
 
 	/* nothing to blit */
 	if (src_x2 <= src_x1 || src_y2 <= src_y1)
-		return;
+		return 1;
 
 	/* clamp x2, y2 to surface size */
 	if (src_x2 > src->handle->width)
@@ -309,7 +346,7 @@ static void intel_blit(struct gralloc_drm_drv_t *drv,
 	bo_table[2] = dst_ib->ibo;
 	if (drm_intel_bufmgr_check_aperture_space(bo_table, 3)) {
 		if (batch_flush(info))
-			return;
+			return -EIO;
 		assert(!drm_intel_bufmgr_check_aperture_space(bo_table, 3));
 	}
 
@@ -323,7 +360,7 @@ static void intel_blit(struct gralloc_drm_drv_t *drv,
 	 */
 	if (src_pitch % 4 != 0 || dst_pitch % 4 != 0) {
 		ALOGE("%s, src and dst pitch must be dword aligned", __func__);
-		return;
+		return -EINVAL;
 	}
 
 	switch (gralloc_drm_get_bpp(dst->handle->format)) {
@@ -336,27 +373,53 @@ static void intel_blit(struct gralloc_drm_drv_t *drv,
 		br13 |= (1 << 24) | (1 << 25);
 		cmd |= XY_SRC_COPY_BLT_WRITE_ALPHA | XY_SRC_COPY_BLT_WRITE_RGB;
 		break;
+	case 8:
+		/* copy pairs of 32-bit pixels */
+		br13 |= (1 << 24) | (1 << 25);
+		cmd |= XY_SRC_COPY_BLT_WRITE_ALPHA | XY_SRC_COPY_BLT_WRITE_RGB;
+		dst_x1 *= 2;
+		dst_x2 *= 2;
+		src_x1 *= 2;
+		src_x2 *= 2;
+		break;
 	default:
 		ALOGE("%s, copy with unsupported format", __func__);
-		return;
+		return -EINVAL;
 	}
 
 	if (info->gen >= 40) {
 		if (dst_ib->tiling != I915_TILING_NONE) {
-			assert(dst_pitch % 512 == 0);
+			assert(dst_pitch %
+			       (dst_ib->tiling == I915_TILING_Y ? 128 : 512) == 0);
 			dst_pitch >>= 2;
 			cmd |= XY_SRC_COPY_BLT_DST_TILED;
 		}
 		if (src_ib->tiling != I915_TILING_NONE) {
-			assert(src_pitch % 512 == 0);
+			assert(src_pitch %
+			       (src_ib->tiling == I915_TILING_Y ? 128 : 512) == 0);
 			src_pitch >>= 2;
 			cmd |= XY_SRC_COPY_BLT_SRC_TILED;
 		}
 	}
 
+	/* the BLT treats tiled surfaces as X-major unless told otherwise */
+	swctrl = 0;
+	if (dst_ib->tiling == I915_TILING_Y)
+		swctrl |= BCS_SWCTRL_DST_Y;
+	if (src_ib->tiling == I915_TILING_Y)
+		swctrl |= BCS_SWCTRL_SRC_Y;
+	if (swctrl && !info->exec_blt) {
+		ALOGE("%s, Y-tiled copy without the BLT ring", __func__);
+		return -EINVAL;
+	}
+
 	unsigned length = (info->gen >= 80) ? 10 : 8;
-	if (batch_reserve(info, length))
-		return;
+	/* keep the BCS_SWCTRL setup and reset in the batch of the blit */
+	if (batch_reserve(info, length + (swctrl ? 2 * 8 + 4 : 0)))
+		return -EIO;
+
+	if (swctrl)
+		batch_swctrl(info, swctrl);
 
 	ALOGD_IF(DEBUG_BLT, "running batch commands, gen=%d tiling: [%d, %d]. dst=[%d, %d, %d, %d], "
 			"src=[%d, %d, %d, %d], pitch=[%d, %d]",
@@ -382,6 +445,9 @@ static void intel_blit(struct gralloc_drm_drv_t *drv,
 		batch_reloc(info, src, I915_GEM_DOMAIN_RENDER, 0);
 	}
 
+	if (swctrl)
+		batch_swctrl(info, 0);
+
 	if (info->gen >= 60) {
 		batch_reserve(info, 4);
 		batch_dword(info, MI_FLUSH_DW | 2);
@@ -397,11 +463,95 @@ static void intel_blit(struct gralloc_drm_drv_t *drv,
 		batch_dword(info, MI_FLUSH | flags);
 	}
 
-	batch_flush(info);
+	return 0;
+}
+
+static void intel_blit(struct gralloc_drm_drv_t *drv,
+		struct gralloc_drm_bo_t *dst,
+		struct gralloc_drm_bo_t *src,
+		uint16_t dst_x1, uint16_t dst_y1,
+		uint16_t dst_x2, uint16_t dst_y2,
+		uint16_t src_x1, uint16_t src_y1,
+		uint16_t src_x2, uint16_t src_y2)
+{
+	struct intel_info *info = (struct intel_info *) drv;
+
+	if (!intel_emit_blit(info, dst, src,
+				dst_x1, dst_y1, dst_x2, dst_y2,
+				src_x1, src_y1, src_x2, src_y2))
+		batch_flush(info);
+}
+
+static int intel_blit_fenced(struct gralloc_drm_drv_t *drv,
+		struct gralloc_drm_bo_t *dst,
+		struct gralloc_drm_bo_t *src,
+		uint16_t dst_x1, uint16_t dst_y1,
+		uint16_t dst_x2, uint16_t dst_y2,
+		uint16_t src_x1, uint16_t src_y1,
+		uint16_t src_x2, uint16_t src_y2,
+		int in_fence, int *out_fence)
+{
+	struct intel_info *info = (struct intel_info *) drv;
+	int ret;
+
+	if (!info->has_exec_fence)
+		return -ENOSYS;
+
+	if (out_fence)
+		*out_fence = -1;
+
+	ret = intel_emit_blit(info, dst, src,
+			dst_x1, dst_y1, dst_x2, dst_y2,
+			src_x1, src_y1, src_x2, src_y2);
+	if (ret > 0) {
+		/* nothing to wait for but the input */
+		if (out_fence && in_fence >= 0)
+			*out_fence = dup(in_fence);
+		return 0;
+	}
+	if (ret)
+		return ret;
+
+	return batch_flush_fenced(info, in_fence, out_fence);
+}
+
+/*
+ * Return true if the tile padding of a tiled bo would not grow it by more
+ * than half of its linear size.
+ */
+static int tiling_is_worthwhile(struct intel_info *info,
+		int width, int height, int bpp, uint32_t tiling)
+{
+	unsigned long linear, pitch, tiled;
+
+	linear = ALIGN(width * bpp, 64) * ALIGN(height, 2);
+
+	if (tiling == I915_TILING_Y) {
+		/* Y tiles are 128 bytes by 32 rows */
+		pitch = ALIGN(width * bpp, 128);
+		tiled = pitch * ALIGN(height, 32);
+	}
+	else {
+		/* X tiles are 512 bytes by 8 rows */
+		pitch = ALIGN(width * bpp, 512);
+		tiled = pitch * ALIGN(height, 8);
+	}
+
+	/* fences need power-of-two sizes of at least 1MiB before gen4 */
+	if (info->gen < 40) {
+		unsigned long size = 1024 * 1024;
+
+		while (size < tiled)
+			size <<= 1;
+		tiled = size;
+	}
+
+	return (tiled <= linear + linear / 2);
 }
 
 static drm_intel_bo *alloc_ibo(struct intel_info *info,
 		const struct gralloc_drm_handle_t *handle,
+		const struct gralloc_drm_constraints *constraints,
 		uint32_t *tiling, unsigned long *stride)
 {
 	drm_intel_bo *ibo;
@@ -420,6 +570,22 @@ static drm_intel_bo *alloc_ibo(struct intel_info *info,
 	aligned_height = handle->height;
 	gralloc_drm_align_geometry(handle->format,
 			&aligned_width, &aligned_height);
+	aligned_width = gralloc_drm_constrain_width(constraints, bpp,
+			aligned_width);
+
+	if (constraints && constraints->contiguous) {
+		ALOGE("contiguous bos are not supported");
+		return NULL;
+	}
+
+	if (handle->format == HAL_PIXEL_FORMAT_BLOB) {
+		/* linear, so that it is mapped through the CPU cache */
+		*tiling = I915_TILING_NONE;
+		*stride = aligned_width;
+
+		return drm_intel_bo_alloc(info->bufmgr, "gralloc-blob",
+				aligned_width * aligned_height, 4096);
+	}
 
 	if (handle->usage & GRALLOC_USAGE_HW_FB) {
 		unsigned long max_stride;
@@ -430,11 +596,13 @@ static drm_intel_bo *alloc_ibo(struct intel_info *info,
 		if (info->gen < 40)
 			max_stride /= 2;
 
+		/* libdrm aligns the pitch for scanout and tiling */
 		name = "gralloc-fb";
-		aligned_width = ALIGN(aligned_width, 64);
 		flags = BO_ALLOC_FOR_RENDER;
 
 		*tiling = I915_TILING_X;
+		if (constraints && constraints->linear)
+			*tiling = I915_TILING_NONE;
 		*stride = aligned_width * bpp;
 		if (*stride > max_stride) {
 			*tiling = I915_TILING_NONE;
@@ -486,6 +654,30 @@ static drm_intel_bo *alloc_ibo(struct intel_info *info,
 			name = "gralloc-buffer";
 		}
 
+		/*
+		 * Y tiles sample and render better from gen9 on.  The BLT
+		 * handles them too, but video and camera blocks may not, and
+		 * the planes of a YUV bo would need tile-aligned offsets.
+		 */
+		if (*tiling == I915_TILING_X && info->gen >= 90 &&
+		    !(handle->usage & (GRALLOC_USAGE_HW_VIDEO_ENCODER |
+				       GRALLOC_USAGE_HW_CAMERA_MASK))) {
+			struct gralloc_drm_plane_layout layout;
+
+			gralloc_drm_get_plane_layout(handle->format,
+					0, 0, &layout);
+			if (layout.num_planes == 1)
+				*tiling = I915_TILING_Y;
+		}
+
+		if (*tiling != I915_TILING_NONE &&
+		    !tiling_is_worthwhile(info, aligned_width,
+			    aligned_height, bpp, *tiling))
+			*tiling = I915_TILING_NONE;
+
+		if (constraints && constraints->linear)
+			*tiling = I915_TILING_NONE;
+
 		if (handle->usage & GRALLOC_USAGE_HW_RENDER)
 			flags = BO_ALLOC_FOR_RENDER;
 
@@ -498,7 +690,8 @@ static drm_intel_bo *alloc_ibo(struct intel_info *info,
 }
 
 static struct gralloc_drm_bo_t *intel_alloc(struct gralloc_drm_drv_t *drv,
-		struct gralloc_drm_handle_t *handle)
+		struct gralloc_drm_handle_t *handle,
+		const struct gralloc_drm_constraints *constraints)
 {
 	struct intel_info *info = (struct intel_info *) drv;
 	struct intel_buffer *ib;
@@ -529,7 +722,8 @@ static struct gralloc_drm_bo_t *intel_alloc(struct gralloc_drm_drv_t *drv,
 	else {
 		unsigned long stride;
 
-		ib->ibo = alloc_ibo(info, handle, &ib->tiling, &stride);
+		ib->ibo = alloc_ibo(info, handle, constraints,
+				&ib->tiling, &stride);
 		if (!ib->ibo) {
 			ALOGE("failed to allocate ibo %dx%d (format %d)",
 					handle->width,
@@ -550,6 +744,10 @@ static struct gralloc_drm_bo_t *intel_alloc(struct gralloc_drm_drv_t *drv,
 	}
 
 	ib->base.fb_handle = ib->ibo->handle;
+	ib->base.size = ib->ibo->size;
+	/* the kernel infers X tiling from the bo, but not Y tiling */
+	if (ib->tiling == I915_TILING_Y)
+		ib->base.modifier = I915_FORMAT_MOD_Y_TILED;
 
 	ib->base.handle = handle;
 
@@ -565,19 +763,50 @@ static void intel_free(struct gralloc_drm_drv_t *drv,
 	free(ib);
 }
 
+/*
+ * Return how a bo should be mapped.  Only tiled bos need the aperture for
+ * detiling; scanout and write-mostly linear bos are mapped WC.
+ */
+static enum intel_map_mode intel_get_map_mode(struct intel_info *info,
+		struct intel_buffer *ib)
+{
+	int usage = ib->base.handle->usage;
+
+	if (ib->tiling != I915_TILING_NONE)
+		return INTEL_MAP_GTT;
+
+	if (!info->map_wc)
+		return (usage & GRALLOC_USAGE_HW_FB) ?
+			INTEL_MAP_GTT : INTEL_MAP_CPU;
+
+	if ((usage & GRALLOC_USAGE_HW_FB) ||
+	    (usage & GRALLOC_USAGE_SW_READ_MASK) != GRALLOC_USAGE_SW_READ_OFTEN)
+		return INTEL_MAP_WC;
+
+	return INTEL_MAP_CPU;
+}
+
 static int intel_map(struct gralloc_drm_drv_t *drv,
 		struct gralloc_drm_bo_t *bo,
 		int x, int y, int w, int h,
 		int enable_write, void **addr)
 {
+	struct intel_info *info = (struct intel_info *) drv;
 	struct intel_buffer *ib = (struct intel_buffer *) bo;
 	int err;
 
-	if (ib->tiling != I915_TILING_NONE ||
-	    (ib->base.handle->usage & GRALLOC_USAGE_HW_FB))
+	ib->map_mode = intel_get_map_mode(info, ib);
+	switch (ib->map_mode) {
+	case INTEL_MAP_GTT:
 		err = drm_intel_gem_bo_map_gtt(ib->ibo);
-	else
+		break;
+	case INTEL_MAP_WC:
+		err = drm_intel_gem_bo_map_wc(ib->ibo);
+		break;
+	default:
 		err = drm_intel_bo_map(ib->ibo, enable_write);
+		break;
+	}
 	if (!err)
 		*addr = ib->ibo->virtual;
 
@@ -589,20 +818,25 @@ static void intel_unmap(struct gralloc_drm_drv_t *drv,
 {
 	struct intel_buffer *ib = (struct intel_buffer *) bo;
 
-	if (ib->tiling != I915_TILING_NONE ||
-	    (ib->base.handle->usage & GRALLOC_USAGE_HW_FB))
+	switch (ib->map_mode) {
+	case INTEL_MAP_GTT:
 		drm_intel_gem_bo_unmap_gtt(ib->ibo);
-	else
+		break;
+	case INTEL_MAP_WC:
+		drm_intel_gem_bo_unmap_wc(ib->ibo);
+		break;
+	default:
 		drm_intel_bo_unmap(ib->ibo);
+		break;
+	}
 }
 
-#include "intel_chipset.h" /* for platform detection macros */
 static void intel_init_kms_features(struct gralloc_drm_drv_t *drv,
 		struct gralloc_drm_t *drm)
 {
 	struct intel_info *info = (struct intel_info *) drv;
 	struct drm_i915_getparam gp;
-	int pageflipping, id, has_blt;
+	int pageflipping, has_blt;
 
 	drm->mode_quirk_vmwgfx = 0;
 	/* why? */
@@ -614,12 +848,6 @@ static void intel_init_kms_features(struct gralloc_drm_drv_t *drv,
 	if (drmCommandWriteRead(drm->fd, DRM_I915_GETPARAM, &gp, sizeof(gp)))
 		pageflipping = 0;
 
-	memset(&gp, 0, sizeof(gp));
-	gp.param = I915_PARAM_CHIPSET_ID;
-	gp.value = &id;
-	if (drmCommandWriteRead(drm->fd, DRM_I915_GETPARAM, &gp, sizeof(gp)))
-		id = 0;
-
 	memset(&gp, 0, sizeof(gp));
 	gp.param = I915_PARAM_HAS_BLT;
 	gp.value = &has_blt;
@@ -627,24 +855,11 @@ static void intel_init_kms_features(struct gralloc_drm_drv_t *drv,
 		has_blt = 0;
 	info->exec_blt = has_blt ? I915_EXEC_BLT : 0;
 
-	/* GEN4, G4X, GEN5, GEN6, GEN7 */
-	if ((IS_9XX(id) || IS_G4X(id)) && !IS_GEN3(id)) {
-		if (IS_GEN9(id))
-			info->gen = 90;
-		else if (IS_GEN8(id))
-			info->gen = 80;
-		else if (IS_GEN7(id))
-			info->gen = 70;
-		else if (IS_GEN6(id))
-			info->gen = 60;
-		else if (IS_GEN5(id))
-			info->gen = 50;
-		else
-			info->gen = 40;
-	}
-	else {
-		info->gen = 30;
-	}
+	memset(&gp, 0, sizeof(gp));
+	gp.param = I915_PARAM_HAS_EXEC_FENCE;
+	gp.value = &info->has_exec_fence;
+	if (drmCommandWriteRead(drm->fd, DRM_I915_GETPARAM, &gp, sizeof(gp)))
+		info->has_exec_fence = 0;
 
 	if (pageflipping && info->gen > 30)
 		drm->swap_mode = DRM_SWAP_FLIP;
@@ -688,6 +903,44 @@ static void intel_destroy(struct gralloc_drm_drv_t *drv)
 	free(info);
 }
 
+#include "intel_chipset.h" /* for platform detection macros */
+static int intel_get_gen(int fd)
+{
+	struct drm_i915_getparam gp;
+	int id;
+
+	memset(&gp, 0, sizeof(gp));
+	gp.param = I915_PARAM_CHIPSET_ID;
+	gp.value = &id;
+	if (drmCommandWriteRead(fd, DRM_I915_GETPARAM, &gp, sizeof(gp)))
+		id = 0;
+
+	/* GEN4, G4X, GEN5 and later */
+	if (!(IS_9XX(id) || IS_G4X(id)) || IS_GEN3(id))
+		return 30;
+
+#ifdef IS_GEN11
+	if (IS_GEN11(id))
+		return 110;
+#endif
+#ifdef IS_GEN10
+	if (IS_GEN10(id))
+		return 100;
+#endif
+	if (IS_GEN9(id))
+		return 90;
+	if (IS_GEN8(id))
+		return 80;
+	if (IS_GEN7(id))
+		return 70;
+	if (IS_GEN6(id))
+		return 60;
+	if (IS_GEN5(id))
+		return 50;
+
+	return 40;
+}
+
 struct gralloc_drm_drv_t *gralloc_drm_drv_create_for_intel(int fd)
 {
 	struct intel_info *info;
@@ -706,8 +959,24 @@ struct gralloc_drm_drv_t *gralloc_drm_drv_create_for_intel(int fd)
 		return NULL;
 	}
 
+	/* allocations depend on the generation, also without KMS */
+	info->gen = intel_get_gen(fd);
+
 	batch_init(info);
 
+	/* WC mmaps need I915_MMAP_WC, i.e. mmap version 1 */
+	if (property_get_bool("debug.drm.intel_map_wc", 1)) {
+		struct drm_i915_getparam gp;
+		int version;
+
+		memset(&gp, 0, sizeof(gp));
+		gp.param = I915_PARAM_MMAP_VERSION;
+		gp.value = &version;
+		if (!drmCommandWriteRead(fd, DRM_I915_GETPARAM, &gp, sizeof(gp)))
+			info->map_wc = (version >= 1);
+	}
+	ALOGI("WC CPU maps %s", info->map_wc ? "enabled" : "disabled");
+
 	info->base.destroy = intel_destroy;
 	info->base.init_kms_features = intel_init_kms_features;
 	info->base.alloc = intel_alloc;
@@ -715,6 +984,7 @@ struct gralloc_drm_drv_t *gralloc_drm_drv_create_for_intel(int fd)
 	info->base.map = intel_map;
 	info->base.unmap = intel_unmap;
 	info->base.blit = intel_blit;
+	info->base.blit_fenced = intel_blit_fenced;
 	info->base.resolve_format = intel_resolve_format;
 
 	return &info->base;
@@ -26,6 +26,7 @@
 #include <cutils/properties.h>
 #include <cutils/log.h>
 #include <errno.h>
+#include <limits.h>
 #include <unistd.h>
 #include <signal.h>
 #include <stdlib.h>
@@ -33,12 +34,30 @@
 #include <string.h>
 #include <poll.h>
 #include <math.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include "gralloc_drm.h"
 #include "gralloc_drm_priv.h"
 #include <hardware_legacy/uevent.h>
+#include <sync/sync.h>
 
 #include <drm_fourcc.h>
 
+/* older drm_fourcc.h */
+#ifndef DRM_FORMAT_P010
+#define DRM_FORMAT_P010 fourcc_code('P', '0', '1', '0')
+#endif
+#ifndef DRM_FORMAT_P016
+#define DRM_FORMAT_P016 fourcc_code('P', '0', '1', '6')
+#endif
+#ifndef DRM_FORMAT_XBGR16161616F
+#define DRM_FORMAT_XBGR16161616F fourcc_code('X', 'B', '4', 'H')
+#endif
+
+/* longest wait on an acquire fence before copying anyway */
+#define DRM_FENCE_TIMEOUT_MS 1000
+
 struct uevent {
 	const char *action;
 	const char *path;
@@ -114,12 +133,20 @@ static unsigned int drm_format_from_hal(int hal_format)
 		case HAL_PIXEL_FORMAT_RGBA_8888:
 //			return DRM_FORMAT_ABGR8888;
 			return DRM_FORMAT_XBGR8888;
+		case HAL_PIXEL_FORMAT_RGBA_1010102:
+			return DRM_FORMAT_XBGR2101010;
+		case HAL_PIXEL_FORMAT_RGBA_FP16:
+			return DRM_FORMAT_XBGR16161616F;
 		case HAL_PIXEL_FORMAT_RGB_565:
 			return DRM_FORMAT_RGB565;
 		case HAL_PIXEL_FORMAT_YV12:
 			return DRM_FORMAT_YUV420;
 		case HAL_PIXEL_FORMAT_DRM_NV12:
 			return DRM_FORMAT_NV12;
+		case HAL_PIXEL_FORMAT_DRM_P010:
+			return DRM_FORMAT_P010;
+		case HAL_PIXEL_FORMAT_DRM_P016:
+			return DRM_FORMAT_P016;
 		default:
 			return 0;
 	}
@@ -176,21 +203,43 @@ int gralloc_drm_bo_add_fb(struct gralloc_drm_bo_t *bo)
 	uint32_t pitches[4] = { 0, 0, 0, 0 };
 	uint32_t offsets[4] = { 0, 0, 0, 0 };
 	uint32_t handles[4] = { 0, 0, 0, 0 };
+	int drm_format, ret;
 
 	if (bo->fb_id)
 		return 0;
 
-	int drm_format = resolve_drm_format(bo, pitches, offsets, handles);
+	drm_format = resolve_drm_format(bo, pitches, offsets, handles);
 
 	if (drm_format == 0) {
 		ALOGE("error resolving drm format");
 		return -EINVAL;
 	}
 
-	return drmModeAddFB2(bo->drm->fd,
-		bo->handle->width, bo->handle->height,
-		drm_format, handles, pitches, offsets,
-		(uint32_t *) &bo->fb_id, 0);
+	if (bo->modifier) {
+		uint64_t modifiers[4] = { 0, 0, 0, 0 };
+		int i;
+
+		for (i = 0; i < 4 && handles[i]; i++)
+			modifiers[i] = bo->modifier;
+
+		ret = drmModeAddFB2WithModifiers(bo->drm->fd,
+			bo->handle->width, bo->handle->height,
+			drm_format, handles, pitches, offsets, modifiers,
+			(uint32_t *) &bo->fb_id, DRM_MODE_FB_MODIFIERS);
+	}
+	else {
+		ret = drmModeAddFB2(bo->drm->fd,
+			bo->handle->width, bo->handle->height,
+			drm_format, handles, pitches, offsets,
+			(uint32_t *) &bo->fb_id, 0);
+	}
+	if (!ret) {
+		pthread_mutex_lock(&bo->drm->stats_mutex);
+		bo->drm->fb_count++;
+		pthread_mutex_unlock(&bo->drm->stats_mutex);
+	}
+
+	return ret;
 }
 
 /*
@@ -201,6 +250,10 @@ void gralloc_drm_bo_rm_fb(struct gralloc_drm_bo_t *bo)
 	if (bo->fb_id) {
 		drmModeRmFB(bo->drm->fd, bo->fb_id);
 		bo->fb_id = 0;
+
+		pthread_mutex_lock(&bo->drm->stats_mutex);
+		bo->drm->fb_count--;
+		pthread_mutex_unlock(&bo->drm->stats_mutex);
 	}
 }
 
@@ -239,6 +292,8 @@ static void page_flip_handler(int fd, unsigned int sequence,
 	/* ack the last scheduled flip */
 	drm->current_front = drm->next_front;
 	drm->next_front = NULL;
+
+	gralloc_drm_add_latency(drm, DRM_LATENCY_FLIP, drm->flip_time);
 }
 
 /*
@@ -278,10 +333,14 @@ static int gralloc_drm_bo_setplane(struct gralloc_drm_t *drm,
 		plane->src_h << 16);
 
 	if (err) {
-		/* clear plane_mask so that this buffer won't be tried again */
+		/*
+		 * clear plane_mask so that this buffer won't be tried again,
+		 * unless it has been validated by gralloc_drm_alloc_video_pool
+		 */
 		struct gralloc_drm_handle_t *drm_handle =
 			(struct gralloc_drm_handle_t *) plane->handle;
-		drm_handle->plane_mask = 0;
+		if (!bo || !bo->pooled)
+			drm_handle->plane_mask = 0;
 
 		ALOGE("drmModeSetPlane : error (%s) (plane %d crtc %d fb %d)",
 			strerror(-err),
@@ -438,6 +497,307 @@ int gralloc_drm_set_plane_handle(struct gralloc_drm_t *drm,
 	return -EINVAL;
 }
 
+/*
+ * Allocate a ring of buffers for video overlays.  Their fbs are created
+ * up front and they are checked to be displayable on a plane of the
+ * primary output, so that showing them never creates an fb or loses
+ * plane eligibility.
+ */
+int gralloc_drm_alloc_video_pool(struct gralloc_drm_t *drm,
+		int width, int height, int format, int usage,
+		int count, struct gralloc_drm_bo_t **bos)
+{
+	struct gralloc_drm_plane_t *plane = drm->planes;
+	unsigned int mask = 0, i;
+	int n, err = 0;
+
+	switch (format) {
+	case HAL_PIXEL_FORMAT_DRM_NV12:
+	case HAL_PIXEL_FORMAT_DRM_P010:
+	case HAL_PIXEL_FORMAT_DRM_P016:
+		break;
+	default:
+		ALOGE("format 0x%x is not a video format", format);
+		return -EINVAL;
+	}
+
+	if (!plane)
+		return -ENODEV;
+
+	/* planes of the primary output that can scan out the format */
+	for (i = 0; i < drm->plane_resources->count_planes; i++, plane++) {
+		if (is_plane_supported(drm, plane))
+			mask |= (1U << plane->drm_plane->plane_id);
+	}
+	mask &= planes_for_format(drm, format);
+	if (!mask) {
+		ALOGE("no plane can show format 0x%x", format);
+		return -ENODEV;
+	}
+
+	for (n = 0; n < count; n++) {
+		bos[n] = gralloc_drm_bo_create(drm, width, height,
+				format, usage);
+		if (!bos[n]) {
+			err = (errno == EDQUOT) ? -EDQUOT : -ENOMEM;
+			break;
+		}
+
+		bos[n]->handle->plane_mask = mask;
+		bos[n]->pooled = 1;
+
+		err = gralloc_drm_bo_add_fb(bos[n]);
+		if (err) {
+			ALOGE("failed to add fb for pooled bo %dx%d (format 0x%x)",
+					width, height, format);
+			gralloc_drm_bo_decref(bos[n]);
+			break;
+		}
+	}
+
+	if (err) {
+		while (n--)
+			gralloc_drm_bo_decref(bos[n]);
+	}
+
+	return err;
+}
+
+/*
+ * Copy between two bos with the CPU.  Only used with drivers whose maps
+ * give a linear view of the bo.
+ */
+static void drm_kms_cpu_copy(struct gralloc_drm_t *drm,
+		struct gralloc_drm_bo_t *dst, struct gralloc_drm_bo_t *src,
+		uint16_t dst_x1, uint16_t dst_y1, uint16_t dst_x2, uint16_t dst_y2,
+		uint16_t src_x1, uint16_t src_y1, uint16_t src_x2, uint16_t src_y2)
+{
+	int bpp = gralloc_drm_get_bpp(dst->handle->format);
+	char *dst_addr, *src_addr;
+	int width, height, y;
+
+	if (!bpp || bpp != gralloc_drm_get_bpp(src->handle->format))
+		return;
+
+	dst_x2 = MIN(dst_x2, dst->handle->width);
+	dst_y2 = MIN(dst_y2, dst->handle->height);
+	src_x2 = MIN(src_x2, src->handle->width);
+	src_y2 = MIN(src_y2, src->handle->height);
+
+	width = MIN(dst_x2 - dst_x1, src_x2 - src_x1);
+	height = MIN(dst_y2 - dst_y1, src_y2 - src_y1);
+	if (width <= 0 || height <= 0)
+		return;
+
+	if (drm->drv->map(drm->drv, src, src_x1, src_y1, width, height, 0,
+				(void **) &src_addr))
+		return;
+	if (drm->drv->map(drm->drv, dst, dst_x1, dst_y1, width, height, 1,
+				(void **) &dst_addr)) {
+		drm->drv->unmap(drm->drv, src);
+		return;
+	}
+
+	src_addr += src_y1 * src->handle->stride + src_x1 * bpp;
+	dst_addr += dst_y1 * dst->handle->stride + dst_x1 * bpp;
+	for (y = 0; y < height; y++) {
+		memcpy(dst_addr, src_addr, width * bpp);
+		src_addr += src->handle->stride;
+		dst_addr += dst->handle->stride;
+	}
+
+	drm->drv->unmap(drm->drv, dst);
+	drm->drv->unmap(drm->drv, src);
+}
+
+/*
+ * Copy between two bos with the engine chosen for the device.  The copy
+ * waits on in_fence when it is not -1, and returns a sync_file signaled on
+ * completion, or -1, in out_fence when it is not NULL.
+ */
+static void drm_kms_copy(struct gralloc_drm_t *drm,
+		struct gralloc_drm_bo_t *dst, struct gralloc_drm_bo_t *src,
+		uint16_t dst_x1, uint16_t dst_y1, uint16_t dst_x2, uint16_t dst_y2,
+		uint16_t src_x1, uint16_t src_y1, uint16_t src_x2, uint16_t src_y2,
+		int in_fence, int *out_fence)
+{
+	int ret = -ENOSYS;
+
+	if (out_fence)
+		*out_fence = -1;
+
+	if (drm->copy_engine != DRM_COPY_CPU && drm->drv->blit_fenced)
+		ret = drm->drv->blit_fenced(drm->drv, dst, src,
+				dst_x1, dst_y1, dst_x2, dst_y2,
+				src_x1, src_y1, src_x2, src_y2,
+				in_fence, out_fence);
+
+	if (ret) {
+		/* no explicit sync, wait for the producer here */
+		if (in_fence >= 0) {
+			struct pollfd pfd = { .fd = in_fence, .events = POLLIN };
+
+			if (poll(&pfd, 1, DRM_FENCE_TIMEOUT_MS) <= 0)
+				ALOGW("timed out waiting for the acquire fence");
+		}
+
+		if (drm->copy_engine == DRM_COPY_CPU || !drm->drv->blit)
+			drm_kms_cpu_copy(drm, dst, src,
+					dst_x1, dst_y1, dst_x2, dst_y2,
+					src_x1, src_y1, src_x2, src_y2);
+		else
+			drm->drv->blit(drm->drv, dst, src,
+					dst_x1, dst_y1, dst_x2, dst_y2,
+					src_x1, src_y1, src_x2, src_y2);
+	}
+}
+
+/*
+ * Take the acquire fence of a post.  All the copies of the post, to the
+ * front and to the mirrors, wait on it.
+ */
+static void drm_kms_begin_post_fences(struct gralloc_drm_t *drm)
+{
+	pthread_mutex_lock(&drm->stats_mutex);
+	drm->post_acquire_fence = drm->present_acquire_fence;
+	drm->present_acquire_fence = -1;
+	pthread_mutex_unlock(&drm->stats_mutex);
+
+	drm->post_fence = -1;
+	drm->post_copies = 0;
+	drm->post_fenced = 1;
+}
+
+/*
+ * Release the acquire fence of a post, and make the fence of all its copies
+ * the present fence.  A post without copies keeps the present fence.
+ */
+static void drm_kms_end_post_fences(struct gralloc_drm_t *drm)
+{
+	if (drm->post_acquire_fence >= 0)
+		close(drm->post_acquire_fence);
+	drm->post_acquire_fence = -1;
+	drm->post_fenced = 0;
+
+	if (!drm->post_copies)
+		return;
+
+	pthread_mutex_lock(&drm->stats_mutex);
+	if (drm->present_fence >= 0)
+		close(drm->present_fence);
+	drm->present_fence = drm->post_fence;
+	pthread_mutex_unlock(&drm->stats_mutex);
+
+	drm->post_fence = -1;
+}
+
+/*
+ * Add the out fence of a copy to the fence of the post.
+ */
+static void drm_kms_merge_post_fence(struct gralloc_drm_t *drm, int fence)
+{
+	int merged;
+
+	if (fence < 0)
+		return;
+
+	if (drm->post_fence < 0) {
+		drm->post_fence = fence;
+		return;
+	}
+
+	merged = sync_merge("gralloc_drm present", drm->post_fence, fence);
+	if (merged < 0) {
+		/* keep the newer fence only once the older has signaled */
+		ALOGW("failed to merge present fences");
+		sync_wait(drm->post_fence, DRM_FENCE_TIMEOUT_MS);
+		close(drm->post_fence);
+		drm->post_fence = fence;
+		return;
+	}
+
+	close(drm->post_fence);
+	close(fence);
+	drm->post_fence = merged;
+}
+
+/*
+ * Copy a bo to the display as part of a post.  Outside of
+ * gralloc_drm_bo_post, such as when calibrating, the copy is not fenced.
+ */
+static void drm_kms_post_copy(struct gralloc_drm_t *drm,
+		struct gralloc_drm_bo_t *dst, struct gralloc_drm_bo_t *src,
+		uint16_t dst_x1, uint16_t dst_y1, uint16_t dst_x2, uint16_t dst_y2,
+		uint16_t src_x1, uint16_t src_y1, uint16_t src_x2, uint16_t src_y2)
+{
+	int out_fence;
+
+	if (!drm->post_fenced) {
+		drm_kms_copy(drm, dst, src,
+				dst_x1, dst_y1, dst_x2, dst_y2,
+				src_x1, src_y1, src_x2, src_y2, -1, NULL);
+		return;
+	}
+
+	drm_kms_copy(drm, dst, src,
+			dst_x1, dst_y1, dst_x2, dst_y2,
+			src_x1, src_y1, src_x2, src_y2,
+			drm->post_acquire_fence, &out_fence);
+	drm->post_copies++;
+	drm_kms_merge_post_fence(drm, out_fence);
+}
+
+/*
+ * Return a sync_file signaled when all the display copies of the last post
+ * complete, or -1 when they have completed or were not fenced.  The caller
+ * owns the fd.
+ */
+int gralloc_drm_get_present_fence(struct gralloc_drm_t *drm)
+{
+	int fence = -1;
+
+	pthread_mutex_lock(&drm->stats_mutex);
+	if (drm->present_fence >= 0)
+		fence = dup(drm->present_fence);
+	pthread_mutex_unlock(&drm->stats_mutex);
+
+	return fence;
+}
+
+/*
+ * Set a sync_file all the display copies of the next post wait on, taking
+ * ownership of it.
+ */
+void gralloc_drm_set_present_acquire_fence(struct gralloc_drm_t *drm,
+		int fence)
+{
+	pthread_mutex_lock(&drm->stats_mutex);
+	if (drm->present_acquire_fence >= 0)
+		close(drm->present_acquire_fence);
+	drm->present_acquire_fence = fence;
+	pthread_mutex_unlock(&drm->stats_mutex);
+}
+
+/*
+ * Account memory traffic of the display path.
+ */
+void gralloc_drm_add_traffic(struct gralloc_drm_t *drm,
+		enum drm_traffic traffic, uint64_t bytes)
+{
+	pthread_mutex_lock(&drm->stats_mutex);
+	drm->traffic[traffic] += bytes;
+	pthread_mutex_unlock(&drm->stats_mutex);
+}
+
+/*
+ * Return the bytes a copy of a bo reads and writes.
+ */
+static uint64_t drm_kms_copy_traffic(struct gralloc_drm_bo_t *bo)
+{
+	return 2 * (uint64_t) gralloc_drm_get_tight_size(bo->handle->format,
+			bo->handle->width, bo->handle->height);
+}
+
 static int drm_kms_blit_to_mirror_connectors(struct gralloc_drm_t *drm, struct gralloc_drm_bo_t *bo)
 {
 	int ret = 0;
@@ -453,11 +813,13 @@ static int drm_kms_blit_to_mirror_connectors(struct gralloc_drm_t *drm, struct g
 			if (output->bo->handle->height > bo->handle->height)
 				dst_y1 = (output->bo->handle->height - bo->handle->height) / 2;
 
-			drm->drv->blit(drm->drv, output->bo, bo,
+			drm_kms_post_copy(drm, output->bo, bo,
 					dst_x1, dst_y1,
 					dst_x1 + bo->handle->width,
 					dst_y1 + bo->handle->height,
 					0, 0, bo->handle->width, bo->handle->height);
+			gralloc_drm_add_traffic(drm, DRM_TRAFFIC_CLONE,
+					drm_kms_copy_traffic(bo));
 
 			ret = drmModePageFlip(drm->fd, output->crtc_id, output->bo->fb_id, 0, NULL);
 			if (ret && errno != EBUSY)
@@ -500,6 +862,7 @@ static int drm_kms_page_flip(struct gralloc_drm_t *drm,
 	/* set planes to be displayed */
 	gralloc_drm_set_planes(drm);
 
+	drm->flip_time = gralloc_drm_get_time_ns();
 	ret = drmModePageFlip(drm->fd, drm->primary->crtc_id, bo->fb_id,
 			DRM_MODE_PAGE_FLIP_EVENT, (void *) drm);
 	if (ret) {
@@ -573,9 +936,60 @@ static void drm_kms_wait_for_post(struct gralloc_drm_t *drm, int flip)
 }
 
 /*
- * Post a bo.  This is not thread-safe.
+ * Return the front a DRM_SWAP_COPY post copies into.  With two fronts, it is
+ * the one that is not scanned out once any pending flip has completed.
  */
-int gralloc_drm_bo_post(struct gralloc_drm_bo_t *bo)
+static struct gralloc_drm_bo_t *drm_kms_get_copy_front(
+		struct gralloc_drm_t *drm)
+{
+	if (!drm->copy_fronts[1])
+		return (drm->next_front) ? drm->next_front : drm->current_front;
+
+	drm_kms_page_flip(drm, NULL);
+
+	return (drm->current_front == drm->copy_fronts[0]) ?
+		drm->copy_fronts[1] : drm->copy_fronts[0];
+}
+
+/*
+ * Show a front of DRM_SWAP_COPY on the next vblank, by flipping to it or,
+ * when flips fail, by setting the CRTC.
+ */
+static int drm_kms_show_copy_front(struct gralloc_drm_t *drm,
+		struct gralloc_drm_bo_t *front)
+{
+	int ret;
+
+	if (!drm->copy_setcrtc) {
+		ret = drm_kms_page_flip(drm, front);
+		if (ret == -EBUSY) {
+			/* the CRTC is busy, try again after a vblank */
+			drm_kms_wait_for_post(drm, 0);
+			ret = drm_kms_page_flip(drm, front);
+		}
+		if (!ret)
+			return 0;
+
+		/* still busy, set the CRTC for this frame only */
+		if (ret != -EBUSY) {
+			ALOGW("flips between copy fronts failed, will set crtc");
+			drm->copy_setcrtc = 1;
+		}
+		drm->first_post = 0;
+	}
+
+	drm_kms_wait_for_post(drm, 0);
+	ret = drm_kms_set_crtc(drm, drm->primary, front->fb_id);
+	if (!ret)
+		drm->current_front = front;
+
+	return ret;
+}
+
+/*
+ * Post a bo with the current swap mode.
+ */
+static int drm_kms_post(struct gralloc_drm_bo_t *bo)
 {
 	struct gralloc_drm_t *drm = bo->drm;
 	int ret;
@@ -591,15 +1005,15 @@ int gralloc_drm_bo_post(struct gralloc_drm_bo_t *bo)
 		if (drm->swap_mode == DRM_SWAP_COPY) {
 			struct gralloc_drm_bo_t *dst;
 
-			dst = (drm->next_front) ?
-				drm->next_front :
-				drm->current_front;
-			drm->drv->blit(drm->drv, dst, bo, 0, 0,
+			dst = drm_kms_get_copy_front(drm);
+			drm_kms_post_copy(drm, dst, bo, 0, 0,
 					bo->handle->width,
 					bo->handle->height,
 					0, 0,
 					bo->handle->width,
 					bo->handle->height);
+			gralloc_drm_add_traffic(drm, DRM_TRAFFIC_COPY,
+					drm_kms_copy_traffic(bo));
 			bo = dst;
 		}
 
@@ -639,17 +1053,35 @@ int gralloc_drm_bo_post(struct gralloc_drm_bo_t *bo)
 		}
 		break;
 	case DRM_SWAP_COPY:
-		drm_kms_wait_for_post(drm, 0);
-		drm->drv->blit(drm->drv, drm->current_front,
-				bo, 0, 0,
-				bo->handle->width,
-				bo->handle->height,
-				0, 0,
-				bo->handle->width,
-				bo->handle->height);
-		if (drm->mode_quirk_vmwgfx)
-			ret = drmModeDirtyFB(drm->fd, drm->current_front->fb_id, &drm->clip, 1);
-		ret = 0;
+		{
+			struct gralloc_drm_bo_t *dst;
+
+			/* a single front is copied into while scanned out */
+			if (!drm->copy_fronts[1])
+				drm_kms_wait_for_post(drm, 0);
+
+			dst = drm_kms_get_copy_front(drm);
+			drm_kms_post_copy(drm, dst,
+					bo, 0, 0,
+					bo->handle->width,
+					bo->handle->height,
+					0, 0,
+					bo->handle->width,
+					bo->handle->height);
+			gralloc_drm_add_traffic(drm, DRM_TRAFFIC_COPY,
+					drm_kms_copy_traffic(bo));
+
+			if (drm->copy_fronts[1]) {
+				if (drm->swap_interval > 1)
+					drm_kms_wait_for_post(drm, 1);
+				ret = drm_kms_show_copy_front(drm, dst);
+				break;
+			}
+
+			if (drm->mode_quirk_vmwgfx)
+				ret = drmModeDirtyFB(drm->fd, dst->fb_id, &drm->clip, 1);
+			ret = 0;
+		}
 		break;
 	case DRM_SWAP_SETCRTC:
 		drm_kms_wait_for_post(drm, 0);
@@ -674,6 +1106,29 @@ int gralloc_drm_bo_post(struct gralloc_drm_bo_t *bo)
 	return ret;
 }
 
+/*
+ * Post a bo.  This is not thread-safe.
+ */
+int gralloc_drm_bo_post(struct gralloc_drm_bo_t *bo)
+{
+	struct gralloc_drm_t *drm = bo->drm;
+	int64_t start = gralloc_drm_get_time_ns();
+	int ret;
+
+	drm_kms_begin_post_fences(drm);
+	ret = drm_kms_post(bo);
+	drm_kms_end_post_fences(drm);
+	if (!ret) {
+		gralloc_drm_add_latency(drm, DRM_LATENCY_POST, start);
+
+		pthread_mutex_lock(&drm->stats_mutex);
+		drm->traffic_frames++;
+		pthread_mutex_unlock(&drm->stats_mutex);
+	}
+
+	return ret;
+}
+
 static struct gralloc_drm_t *drm_singleton;
 
 static void on_signal(int sig)
@@ -692,13 +1147,26 @@ static void on_signal(int sig)
 	exit(-1);
 }
 
-static void drm_kms_init_features(struct gralloc_drm_t *drm)
+static const char *drm_kms_swap_mode_name(enum drm_swap_mode mode)
 {
-	const char *swap_mode;
-
-	/* call to the driver here, after KMS has been initialized */
-	drm->drv->init_kms_features(drm->drv, drm);
+	switch (mode) {
+	case DRM_SWAP_FLIP:
+		return "flip";
+	case DRM_SWAP_COPY:
+		return "copy";
+	case DRM_SWAP_SETCRTC:
+		return "set-crtc";
+	default:
+		return "no-op";
+	}
+}
 
+/*
+ * Set up what the current swap mode needs.  Fall back to DRM_SWAP_SETCRTC
+ * when that fails.
+ */
+static void drm_kms_init_swap_mode(struct gralloc_drm_t *drm)
+{
 	if (drm->swap_mode == DRM_SWAP_FLIP) {
 		struct sigaction act;
 
@@ -720,42 +1188,528 @@ static void drm_kms_init_features(struct gralloc_drm_t *drm)
 		drm_singleton = drm;
 	}
 	else if (drm->swap_mode == DRM_SWAP_COPY) {
-		struct gralloc_drm_bo_t *front;
-
-		/* create the real front buffer */
-		front = gralloc_drm_bo_create(drm,
-					      drm->primary->mode.hdisplay,
-					      drm->primary->mode.vdisplay,
-					      drm->primary->fb_format,
-					      GRALLOC_USAGE_HW_FB);
-		if (front && gralloc_drm_bo_add_fb(front)) {
-			gralloc_drm_bo_decref(front);
-			front = NULL;
+		/* a single front saves memory but tears */
+		int count = property_get_bool("debug.drm.copy_single_front", 0) ?
+			1 : 2;
+		int i;
+
+		/* create the real front buffers */
+		for (i = 0; i < count; i++) {
+			struct gralloc_drm_bo_t *front;
+
+			front = gralloc_drm_bo_create(drm,
+						      drm->primary->mode.hdisplay,
+						      drm->primary->mode.vdisplay,
+						      drm->primary->fb_format,
+						      GRALLOC_USAGE_HW_FB);
+			if (front && gralloc_drm_bo_add_fb(front)) {
+				gralloc_drm_bo_decref(front);
+				front = NULL;
+			}
+			if (!front)
+				break;
+
+			drm->copy_fronts[i] = front;
 		}
 
-		/* abuse next_front */
-		if (front)
-			drm->next_front = front;
-		else
+		drm->copy_setcrtc = 0;
+		if (drm->copy_fronts[1]) {
+			memset(&drm->evctx, 0, sizeof(drm->evctx));
+			drm->evctx.version = DRM_EVENT_CONTEXT_VERSION;
+			drm->evctx.page_flip_handler = page_flip_handler;
+		}
+		else if (drm->copy_fronts[0]) {
+			ALOGW_IF(count > 1, "copying into a single front");
+			/* abuse next_front */
+			drm->next_front = drm->copy_fronts[0];
+		}
+		else {
 			drm->swap_mode = DRM_SWAP_SETCRTC;
+		}
 	}
+}
 
+/*
+ * Tear down what the current swap mode has set up.
+ */
+static void drm_kms_fini_swap_mode(struct gralloc_drm_t *drm)
+{
 	switch (drm->swap_mode) {
 	case DRM_SWAP_FLIP:
-		swap_mode = "flip";
+		drm_kms_page_flip(drm, NULL);
 		break;
 	case DRM_SWAP_COPY:
-		swap_mode = "copy";
-		break;
-	case DRM_SWAP_SETCRTC:
-		swap_mode = "set-crtc";
+		{
+			int i;
+
+			/* wait for the flip to the last front */
+			if (drm->copy_fronts[1])
+				drm_kms_page_flip(drm, NULL);
+
+			for (i = 0; i < 2; i++) {
+				if (drm->copy_fronts[i])
+					gralloc_drm_bo_decref(drm->copy_fronts[i]);
+				drm->copy_fronts[i] = NULL;
+			}
+			drm->current_front = NULL;
+			drm->next_front = NULL;
+		}
 		break;
 	default:
-		swap_mode = "no-op";
 		break;
 	}
+}
+
+#define CALIBRATION_CACHE_DIR "/data/vendor/gralloc"
+#define CALIBRATION_POSTS 8
+#define CALIBRATION_COPIES 4
+#define CALIBRATION_MAPS 4
+
+/*
+ * Return true if the calibration may pick a swap mode.  Tearing modes are
+ * never picked unless the driver has chosen them already.
+ */
+static int drm_kms_swap_mode_allowed(struct gralloc_drm_t *drm,
+		enum drm_swap_mode default_mode, enum drm_swap_mode mode)
+{
+	switch (mode) {
+	case DRM_SWAP_FLIP:
+	case DRM_SWAP_SETCRTC:
+		return (mode == default_mode);
+	case DRM_SWAP_COPY:
+		return (mode == default_mode || drm->drv->blit != NULL);
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Get the path of the calibration cache of the device and the mode.
+ */
+static int drm_kms_calibration_path(struct gralloc_drm_t *drm,
+		char *path, size_t len)
+{
+	drmVersionPtr version;
+	drmDevicePtr dev;
+	uint16_t vendor_id = 0, device_id = 0;
+
+	version = drmGetVersion(drm->fd);
+	if (!version)
+		return -EINVAL;
+
+	if (!drmGetDevice(drm->fd, &dev)) {
+		if (dev->bustype == DRM_BUS_PCI) {
+			vendor_id = dev->deviceinfo.pci->vendor_id;
+			device_id = dev->deviceinfo.pci->device_id;
+		}
+		drmFreeDevice(&dev);
+	}
+
+	snprintf(path, len, CALIBRATION_CACHE_DIR "/kms-%s-%04x-%04x-%dx%d",
+			version->name, vendor_id, device_id,
+			drm->primary->mode.hdisplay,
+			drm->primary->mode.vdisplay);
+	drmFreeVersion(version);
+
+	return 0;
+}
+
+static int drm_kms_load_calibration(struct gralloc_drm_t *drm,
+		const char *path, enum drm_swap_mode default_mode)
+{
+	int swap_mode, copy_engine, n;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return -errno;
+	n = fscanf(fp, "swap_mode=%d copy_engine=%d", &swap_mode, &copy_engine);
+	fclose(fp);
+
+	/* the driver may have changed since */
+	if (n != 2 || !drm_kms_swap_mode_allowed(drm, default_mode,
+				(enum drm_swap_mode) swap_mode) ||
+			(copy_engine != DRM_COPY_GPU &&
+			 copy_engine != DRM_COPY_CPU)) {
+		ALOGW("ignoring stale calibration %s", path);
+		return -EINVAL;
+	}
+
+	drm->swap_mode = (enum drm_swap_mode) swap_mode;
+	drm->copy_engine = (enum drm_copy_engine) copy_engine;
+	drm->calibration.source = 2;
+
+	return 0;
+}
+
+static void drm_kms_store_calibration(struct gralloc_drm_t *drm,
+		const char *path)
+{
+	FILE *fp;
+
+	if (mkdir(CALIBRATION_CACHE_DIR, 0770) && errno != EEXIST)
+		return;
+
+	fp = fopen(path, "w");
+	if (!fp) {
+		ALOGW("failed to store calibration %s (%s)",
+				path, strerror(errno));
+		return;
+	}
+	fprintf(fp, "swap_mode=%d copy_engine=%d\n",
+			drm->swap_mode, drm->copy_engine);
+	fclose(fp);
+}
+
+/*
+ * Return the average time in us to map and unmap an idle bo.
+ */
+static uint32_t drm_kms_time_maps(struct gralloc_drm_t *drm,
+		struct gralloc_drm_bo_t *bo)
+{
+	int64_t start = gralloc_drm_get_time_ns();
+	void *addr;
+	int i;
 
-	ALOGD("will use %s for fb posting", swap_mode);
+	for (i = 0; i < CALIBRATION_MAPS; i++) {
+		if (drm->drv->map(drm->drv, bo, 0, 0, bo->handle->width,
+					bo->handle->height, 0, &addr))
+			return 0;
+		drm->drv->unmap(drm->drv, bo);
+	}
+
+	return (gralloc_drm_get_time_ns() - start) / CALIBRATION_MAPS / 1000;
+}
+
+/*
+ * Return the throughput in MB/s of copying between two front buffers with
+ * the given engine.
+ */
+static uint32_t drm_kms_time_copies(struct gralloc_drm_t *drm,
+		enum drm_copy_engine engine, struct gralloc_drm_bo_t **bos,
+		uint32_t map_us)
+{
+	struct gralloc_drm_handle_t *handle = bos[0]->handle;
+	enum drm_copy_engine old_engine = drm->copy_engine;
+	int64_t start, elapsed;
+	void *addr;
+	int i;
+
+	drm->copy_engine = engine;
+
+	start = gralloc_drm_get_time_ns();
+	for (i = 0; i < CALIBRATION_COPIES; i++)
+		drm_kms_copy(drm, bos[(i + 1) & 1], bos[i & 1],
+				0, 0, handle->width, handle->height,
+				0, 0, handle->width, handle->height, -1, NULL);
+
+	/* a map waits for the GPU to finish the copies */
+	if (!drm->drv->map(drm->drv, bos[CALIBRATION_COPIES & 1], 0, 0,
+				handle->width, handle->height, 0, &addr))
+		drm->drv->unmap(drm->drv, bos[CALIBRATION_COPIES & 1]);
+	elapsed = gralloc_drm_get_time_ns() - start - map_us * 1000;
+
+	drm->copy_engine = old_engine;
+
+	if (elapsed <= 0)
+		elapsed = 1;
+
+	/* bytes per us is MB/s */
+	return (uint64_t) handle->stride * handle->height *
+		CALIBRATION_COPIES * 1000 / elapsed;
+}
+
+/*
+ * Return the average time in us of a post in the given swap mode, or 0 if
+ * the swap mode does not work.
+ */
+static uint32_t drm_kms_time_posts(struct gralloc_drm_t *drm,
+		enum drm_swap_mode mode, struct gralloc_drm_bo_t **bos)
+{
+	int64_t start, elapsed;
+	int i, ret;
+
+	drm->swap_mode = mode;
+	drm_kms_init_swap_mode(drm);
+	if (drm->swap_mode != mode)
+		return 0;
+
+	drm->first_post = 1;
+	ret = drm_kms_post(bos[0]);
+
+	start = gralloc_drm_get_time_ns();
+	for (i = 1; !ret && i <= CALIBRATION_POSTS; i++)
+		ret = drm_kms_post(bos[i & 1]);
+	/* this waits for the last flip */
+	drm_kms_fini_swap_mode(drm);
+	elapsed = gralloc_drm_get_time_ns() - start;
+
+	drm->current_front = NULL;
+	drm->next_front = NULL;
+
+	if (ret)
+		return 0;
+
+	return MAX(elapsed / CALIBRATION_POSTS / 1000, 1);
+}
+
+/*
+ * Measure the swap modes and the copy engines the device supports, and pick
+ * the fastest ones.  The outcome is cached per device and mode.
+ */
+static void drm_kms_calibrate(struct gralloc_drm_t *drm)
+{
+	struct gralloc_drm_kms_calibration *cal = &drm->calibration;
+	enum drm_swap_mode default_mode = drm->swap_mode, best_mode;
+	struct gralloc_drm_bo_t *bos[2] = { NULL, NULL };
+	char path[PATH_MAX];
+	int has_path, i;
+
+	if (default_mode == DRM_SWAP_NOOP)
+		return;
+
+	has_path = !drm_kms_calibration_path(drm, path, sizeof(path));
+	if (has_path && !drm_kms_load_calibration(drm, path, default_mode))
+		return;
+
+	for (i = 0; i < 2; i++) {
+		bos[i] = gralloc_drm_bo_create(drm,
+				drm->primary->mode.hdisplay,
+				drm->primary->mode.vdisplay,
+				drm->primary->fb_format,
+				GRALLOC_USAGE_HW_FB | GRALLOC_USAGE_HW_RENDER);
+		if (!bos[i] || gralloc_drm_bo_add_fb(bos[i])) {
+			ALOGE("failed to create bos for calibration");
+			goto out;
+		}
+	}
+
+	cal->map_us = drm_kms_time_maps(drm, bos[0]);
+
+	/* drivers without blit always copy with the CPU */
+	if (drm->drv->blit) {
+		cal->gpu_copy_mbps = drm_kms_time_copies(drm,
+				DRM_COPY_GPU, bos, cal->map_us);
+		cal->cpu_copy_mbps = drm_kms_time_copies(drm,
+				DRM_COPY_CPU, bos, cal->map_us);
+		drm->copy_engine = (cal->cpu_copy_mbps > cal->gpu_copy_mbps) ?
+			DRM_COPY_CPU : DRM_COPY_GPU;
+	}
+
+	best_mode = default_mode;
+	for (i = DRM_SWAP_FLIP; i <= DRM_SWAP_SETCRTC; i++) {
+		uint32_t us;
+
+		if (!drm_kms_swap_mode_allowed(drm, default_mode,
+					(enum drm_swap_mode) i))
+			continue;
+
+		us = drm_kms_time_posts(drm, (enum drm_swap_mode) i, bos);
+		cal->post_us[i] = us;
+		if (us && (!cal->post_us[best_mode] ||
+				us < cal->post_us[best_mode]))
+			best_mode = (enum drm_swap_mode) i;
+	}
+
+	drm->swap_mode = best_mode;
+	cal->source = 1;
+
+	if (has_path)
+		drm_kms_store_calibration(drm, path);
+
+out:
+	for (i = 0; i < 2; i++)
+		if (bos[i])
+			gralloc_drm_bo_decref(bos[i]);
+	if (!cal->source)
+		drm->swap_mode = default_mode;
+}
+
+/*
+ * Force the swap mode named by debug.drm.swap_mode, for benchmarks.  Tearing
+ * is fine there, so set-crtc is always allowed.  Return true if forced.
+ */
+static int drm_kms_force_swap_mode(struct gralloc_drm_t *drm)
+{
+	char value[PROPERTY_VALUE_MAX];
+	int i;
+
+	if (!property_get("debug.drm.swap_mode", value, NULL))
+		return 0;
+
+	for (i = DRM_SWAP_FLIP; i <= DRM_SWAP_SETCRTC; i++) {
+		if (!strcmp(value, drm_kms_swap_mode_name((enum drm_swap_mode) i)))
+			break;
+	}
+	if (i > DRM_SWAP_SETCRTC || (i != DRM_SWAP_SETCRTC &&
+			!drm_kms_swap_mode_allowed(drm, drm->swap_mode,
+				(enum drm_swap_mode) i))) {
+		ALOGW("ignoring unsupported swap mode %s", value);
+		return 0;
+	}
+
+	drm->swap_mode = (enum drm_swap_mode) i;
+
+	return 1;
+}
+
+static void drm_kms_init_features(struct gralloc_drm_t *drm)
+{
+	struct gralloc_drm_kms_calibration *cal = &drm->calibration;
+
+	/* call to the driver here, after KMS has been initialized */
+	drm->drv->init_kms_features(drm->drv, drm);
+	drm->copy_engine = DRM_COPY_GPU;
+
+	memset(cal, 0, sizeof(*cal));
+	if (!drm_kms_force_swap_mode(drm) &&
+			property_get_bool("debug.drm.calibrate", 0)) {
+		drm_kms_calibrate(drm);
+
+		/* forget the traffic of the calibration */
+		drm->traffic_frames = 0;
+		memset(drm->traffic, 0, sizeof(drm->traffic));
+	}
+
+	drm_kms_init_swap_mode(drm);
+
+	cal->swap_mode = drm->swap_mode;
+	cal->copy_engine = drm->copy_engine;
+
+	ALOGD("will use %s for fb posting", drm_kms_swap_mode_name(drm->swap_mode));
+	if (cal->source)
+		ALOGI("%s calibration: %s, %s copies, post us %u/%u/%u, "
+			"copy MB/s gpu %u cpu %u, map us %u",
+			(cal->source == 1) ? "measured" : "cached",
+			drm_kms_swap_mode_name(drm->swap_mode),
+			(drm->copy_engine == DRM_COPY_CPU) ? "cpu" : "gpu",
+			cal->post_us[DRM_SWAP_FLIP],
+			cal->post_us[DRM_SWAP_COPY],
+			cal->post_us[DRM_SWAP_SETCRTC],
+			cal->gpu_copy_mbps, cal->cpu_copy_mbps, cal->map_us);
+}
+
+/*
+ * Estimate the memory traffic of the display path.  Scanout is computed
+ * from the current outputs and planes, the rest is averaged over the frames
+ * posted since the last reset.
+ */
+void gralloc_drm_get_bandwidth(struct gralloc_drm_t *drm,
+		struct gralloc_drm_bandwidth *bw, int reset)
+{
+	uint64_t scanout_per_second = 0;
+	uint32_t frames;
+	int i;
+
+	memset(bw, 0, sizeof(*bw));
+	bw->refresh = drm->primary->mode.vrefresh;
+
+	pthread_mutex_lock(&drm->outputs_mutex);
+	for (i = 0; i < drm->output_capacity; i++) {
+		struct gralloc_drm_output *output = &drm->outputs[i];
+		uint64_t bytes;
+
+		if (!output->active)
+			continue;
+
+		bytes = gralloc_drm_get_tight_size(output->fb_format,
+				output->mode.hdisplay, output->mode.vdisplay);
+		bw->scanout_bytes += bytes;
+		scanout_per_second += bytes * output->mode.vrefresh;
+	}
+	pthread_mutex_unlock(&drm->outputs_mutex);
+
+	if (drm->plane_resources) {
+		for (i = 0; i < (int) drm->plane_resources->count_planes; i++) {
+			struct gralloc_drm_plane_t *plane = &drm->planes[i];
+			struct gralloc_drm_handle_t *handle;
+
+			if (!plane->active || !plane->handle)
+				continue;
+
+			handle = gralloc_drm_handle(plane->handle);
+			if (!handle)
+				continue;
+
+			/* planes are fetched at their source size */
+			bw->plane_bytes += gralloc_drm_get_tight_size(
+					handle->format,
+					plane->src_w, plane->src_h);
+		}
+		bw->scanout_bytes += bw->plane_bytes;
+		scanout_per_second += bw->plane_bytes * bw->refresh;
+	}
+
+	pthread_mutex_lock(&drm->stats_mutex);
+	frames = drm->traffic_frames;
+	bw->frames = frames;
+	if (frames) {
+		bw->clone_bytes = drm->traffic[DRM_TRAFFIC_CLONE] / frames;
+		bw->copy_bytes = drm->traffic[DRM_TRAFFIC_COPY] / frames;
+		bw->map_bytes = drm->traffic[DRM_TRAFFIC_MAP] / frames;
+	}
+	if (reset) {
+		drm->traffic_frames = 0;
+		memset(drm->traffic, 0, sizeof(drm->traffic));
+	}
+	pthread_mutex_unlock(&drm->stats_mutex);
+
+	bw->frame_bytes = bw->scanout_bytes + bw->clone_bytes +
+		bw->copy_bytes + bw->map_bytes;
+	bw->second_bytes = scanout_per_second + (bw->clone_bytes +
+			bw->copy_bytes + bw->map_bytes) * bw->refresh;
+}
+
+/*
+ * Read the CRC of the next frame scanned out by the primary CRTC from
+ * debugfs.  Return the number of CRC values, which depends on the driver.
+ */
+int gralloc_drm_get_crtc_crc(struct gralloc_drm_t *drm,
+		uint32_t *frame, uint32_t *crcs, int count)
+{
+	char path[PATH_MAX], line[256], *p, *end;
+	struct stat st;
+	int fd, len, n;
+
+	if (fstat(drm->fd, &st))
+		return -errno;
+
+	/* the default source is fine, so there is no need to write control */
+	snprintf(path, sizeof(path), "/sys/kernel/debug/dri/%u/crtc-%u/crc/data",
+			minor(st.st_rdev), drm->primary->pipe);
+
+	/* opening data starts the capture, and a read waits for an entry */
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	len = read(fd, line, sizeof(line) - 1);
+	if (len < 0)
+		len = -errno;
+	close(fd);
+	if (len <= 0)
+		return (len) ? len : -EIO;
+	line[len] = '\0';
+
+	/* an entry is the frame followed by the CRC values, all in hex */
+	*frame = strtoul(line, &end, 16);
+	if (end == line)
+		return -EIO;
+	for (n = 0, p = end; n < count; n++, p = end) {
+		crcs[n] = strtoul(p, &end, 16);
+		if (end == p)
+			break;
+	}
+
+	return n;
+}
+
+/*
+ * Get the outcome of the KMS calibration.
+ */
+void gralloc_drm_get_kms_calibration(struct gralloc_drm_t *drm,
+		struct gralloc_drm_kms_calibration *cal)
+{
+	*cal = drm->calibration;
 }
 
 #define MARGIN_PERCENT 1.8   /* % of active vertical image*/
@@ -1341,23 +2295,7 @@ int gralloc_drm_init_kms(struct gralloc_drm_t *drm)
 
 void gralloc_drm_fini_kms(struct gralloc_drm_t *drm)
 {
-	switch (drm->swap_mode) {
-	case DRM_SWAP_FLIP:
-		drm_kms_page_flip(drm, NULL);
-		break;
-	case DRM_SWAP_COPY:
-		{
-			struct gralloc_drm_bo_t **bo = (drm->current_front) ?
-				&drm->current_front : &drm->next_front;
-
-			if (*bo)
-				gralloc_drm_bo_decref(*bo);
-			*bo = NULL;
-		}
-		break;
-	default:
-		break;
-	}
+	drm_kms_fini_swap_mode(drm);
 
 	/* restore crtc? */
 
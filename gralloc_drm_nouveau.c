@@ -78,13 +78,15 @@ struct nouveau_buffer {
 };
 
 static struct nouveau_bo *alloc_bo(struct nouveau_info *info,
-		int width, int height, int cpp, int usage, int *pitch)
+		int width, int height, int cpp, int usage,
+		const struct gralloc_drm_constraints *constraints, int *pitch)
 {
 	struct nouveau_bo *bo = NULL;
 	union nouveau_bo_config cfg = {};
 	int flags;
 	int tiled, scanout, sw_indicator;
 	unsigned int align;
+	unsigned long size;
 
 	flags = NOUVEAU_BO_MAP | NOUVEAU_BO_VRAM;
 
@@ -106,6 +108,9 @@ static struct nouveau_bo *alloc_bo(struct nouveau_info *info,
 		align = 64;
 	}
 
+	if (constraints && constraints->linear)
+		tiled = 0;
+
 	*pitch = ALIGN(width * cpp, align);
 
 	if (tiled) {
@@ -187,24 +192,52 @@ static struct nouveau_bo *alloc_bo(struct nouveau_info *info,
 			cfg.nv04.surf_flags |= NV04_BO_16BPP;
 	}
 
-	if (scanout)
+	if (scanout || (constraints && constraints->contiguous))
 		flags |= NOUVEAU_BO_CONTIG;
 
+	/* big buffers get big pages */
+	size = *pitch * height;
+	align = gralloc_drm_large_page_align(&size);
+
 #ifdef SW_INDICATOR_FULLY_DISABLES_TILING
-	if (nouveau_bo_new(info->dev, flags, 0, *pitch * height, NULL, &bo)) {
+	if (nouveau_bo_new(info->dev, flags, align, size, NULL, &bo)) {
 #else
-	if (nouveau_bo_new(info->dev, flags, 0, *pitch * height, &cfg, &bo)) {
+	if (nouveau_bo_new(info->dev, flags, align, size, &cfg, &bo)) {
 #endif
-		ALOGE("failed to allocate bo (flags 0x%x, size %d)",
-				flags, *pitch * height);
+		ALOGE("failed to allocate bo (flags 0x%x, size %lu)",
+				flags, size);
 		bo = NULL;
 	}
 
 	return bo;
 }
 
+/*
+ * Allocate a linear byte buffer in GART, which the CPU maps cached.
+ */
+static struct nouveau_bo *alloc_blob(struct nouveau_info *info,
+		int size, const struct gralloc_drm_constraints *constraints,
+		int *pitch)
+{
+	struct nouveau_bo *bo = NULL;
+	uint32_t flags = NOUVEAU_BO_MAP | NOUVEAU_BO_GART;
+
+	if (constraints && constraints->contiguous)
+		flags |= NOUVEAU_BO_CONTIG;
+
+	if (nouveau_bo_new(info->dev, flags, 4096, size, NULL, &bo)) {
+		ALOGE("failed to allocate blob bo (size %d)", size);
+		bo = NULL;
+	}
+
+	*pitch = size;
+
+	return bo;
+}
+
 static struct gralloc_drm_bo_t *nouveau_alloc(struct gralloc_drm_drv_t *drv,
-		struct gralloc_drm_handle_t *handle)
+		struct gralloc_drm_handle_t *handle,
+		const struct gralloc_drm_constraints *constraints)
 {
 	struct nouveau_info *info = (struct nouveau_info *) drv;
 	struct nouveau_buffer *nb;
@@ -234,9 +267,14 @@ static struct gralloc_drm_bo_t *nouveau_alloc(struct gralloc_drm_drv_t *drv,
 		width = handle->width;
 		height = handle->height;
 		gralloc_drm_align_geometry(handle->format, &width, &height);
+		width = gralloc_drm_constrain_width(constraints, cpp, width);
 
-		nb->bo = alloc_bo(info, width, height, cpp,
-				  handle->usage, &pitch);
+		if (handle->format == HAL_PIXEL_FORMAT_BLOB)
+			nb->bo = alloc_blob(info, width * height,
+					constraints, &pitch);
+		else
+			nb->bo = alloc_bo(info, width, height, cpp,
+					  handle->usage, constraints, &pitch);
 		if (!nb->bo) {
 			ALOGE("failed to allocate nouveau bo %dx%dx%d",
 					handle->width, handle->height, cpp);
@@ -257,6 +295,7 @@ static struct gralloc_drm_bo_t *nouveau_alloc(struct gralloc_drm_drv_t *drv,
 
 	if (handle->usage & GRALLOC_USAGE_HW_FB)
 		nb->base.fb_handle = nb->bo->handle;
+	nb->base.size = nb->bo->size;
 
 	nb->base.handle = handle;
 
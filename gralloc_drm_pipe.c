@@ -46,18 +46,40 @@ struct pipe_manager {
 	struct gralloc_drm_drv_t base;
 
 	int fd;
-	void *gallium;
 	pthread_mutex_t mutex;
-	struct pipe_loader_device *dev;
 	struct pipe_screen *screen;
 	struct pipe_context *context;
+
+	/* a screen of its own, when the shared one is on another fd */
+	struct pipe_loader_device *dev;
+	int private_screen;
 };
 
+/*
+ * gallium_dri.so and the screen shared by all pipe managers on the same fd.
+ *
+ * This is not the screen of EGL.  Mesa has no interface to get the screen
+ * of an EGLDisplay, so what is shared with EGL is the library, which is the
+ * copy EGL loaded when there is one, and the winsys of an fd when the
+ * winsys looks the fd up in its per-device table.
+ */
+static struct {
+	pthread_mutex_t mutex;
+	void *gallium;
+	int gallium_refcount;
+
+	int fd;
+	struct pipe_loader_device *dev;
+	struct pipe_screen *screen;
+	int refcount;
+} pipe_shared = { PTHREAD_MUTEX_INITIALIZER, NULL, 0, -1, NULL, NULL, 0 };
+
 struct pipe_buffer {
 	struct gralloc_drm_bo_t base;
 
 	struct pipe_resource *resource;
 	struct winsys_handle winsys;
+	unsigned handle_usage;
 
 	struct pipe_transfer *transfer;
 };
@@ -82,8 +104,26 @@ static enum pipe_format get_pipe_format(int format)
 	case HAL_PIXEL_FORMAT_BGRA_8888:
 		fmt = PIPE_FORMAT_B8G8R8A8_UNORM;
 		break;
+	case HAL_PIXEL_FORMAT_RGBA_1010102:
+		fmt = PIPE_FORMAT_R10G10B10A2_UNORM;
+		break;
+	case HAL_PIXEL_FORMAT_RGBA_FP16:
+		fmt = PIPE_FORMAT_R16G16B16A16_FLOAT;
+		break;
+	case HAL_PIXEL_FORMAT_BLOB:
+	case HAL_PIXEL_FORMAT_Y8:
+	case HAL_PIXEL_FORMAT_RAW10: /* sampled as bytes */
+		fmt = PIPE_FORMAT_R8_UNORM;
+		break;
+	case HAL_PIXEL_FORMAT_Y16:
+	case HAL_PIXEL_FORMAT_RAW16:
+	case HAL_PIXEL_FORMAT_RAW_OPAQUE:
+		fmt = PIPE_FORMAT_R16_UNORM;
+		break;
 	case HAL_PIXEL_FORMAT_YV12:
 	case HAL_PIXEL_FORMAT_DRM_NV12:
+	case HAL_PIXEL_FORMAT_DRM_P010:
+	case HAL_PIXEL_FORMAT_DRM_P016:
 	case HAL_PIXEL_FORMAT_YCbCr_422_SP:
 	case HAL_PIXEL_FORMAT_YCrCb_420_SP:
 	default:
@@ -112,8 +152,28 @@ static unsigned get_pipe_bind(int usage)
 	return bind;
 }
 
+/*
+ * Return how the users of a shared resource access it, so that drivers
+ * keep compression on buffers that are only read by other processes.
+ */
+static unsigned get_pipe_handle_usage(int usage)
+{
+	unsigned handle_usage = 0;
+
+	/*
+	 * GPU writers flush the resource when done, see pipe_blit.  Buffers
+	 * that are only read keep the default usage.
+	 */
+	if (usage & (GRALLOC_USAGE_HW_RENDER | GRALLOC_USAGE_HW_FB))
+		handle_usage |= PIPE_HANDLE_USAGE_FRAMEBUFFER_WRITE |
+			PIPE_HANDLE_USAGE_EXPLICIT_FLUSH;
+
+	return handle_usage;
+}
+
 static struct pipe_buffer *get_pipe_buffer_locked(struct pipe_manager *pm,
-		const struct gralloc_drm_handle_t *handle)
+		const struct gralloc_drm_handle_t *handle,
+		const struct gralloc_drm_constraints *constraints)
 {
 	struct pipe_buffer *buf;
 	struct pipe_resource templ;
@@ -121,8 +181,17 @@ static struct pipe_buffer *get_pipe_buffer_locked(struct pipe_manager *pm,
 	memset(&templ, 0, sizeof(templ));
 	templ.format = get_pipe_format(handle->format);
 	templ.bind = get_pipe_bind(handle->usage);
+	if (constraints && constraints->linear)
+		templ.bind |= PIPE_BIND_LINEAR;
 	templ.target = PIPE_TEXTURE_2D;
 
+	/* a linear byte buffer that the CPU reads back cached */
+	if (handle->format == HAL_PIXEL_FORMAT_BLOB) {
+		templ.target = PIPE_BUFFER;
+		templ.usage = PIPE_USAGE_STAGING;
+		templ.bind &= PIPE_BIND_SHARED;
+	}
+
 	if (templ.format == PIPE_FORMAT_NONE ||
 	    !pm->screen->is_format_supported(pm->screen, templ.format,
 				templ.target, 0, 0, templ.bind)) {
@@ -138,16 +207,21 @@ static struct pipe_buffer *get_pipe_buffer_locked(struct pipe_manager *pm,
 
 	templ.width0 = handle->width;
 	templ.height0 = handle->height;
+	/* in bytes */
+	if (handle->format == HAL_PIXEL_FORMAT_RAW10)
+		templ.width0 = ALIGN(handle->width, 4) * 5 / 4;
 	templ.depth0 = 1;
 	templ.array_size = 1;
 
+	buf->handle_usage = get_pipe_handle_usage(handle->usage);
+
 	if (handle->name) {
 		buf->winsys.type = WINSYS_HANDLE_TYPE_SHARED;
 		buf->winsys.handle = handle->name;
 		buf->winsys.stride = handle->stride;
 
 		buf->resource = pm->screen->resource_from_handle(pm->screen,
-				&templ, &buf->winsys, PIPE_HANDLE_USAGE_FRAMEBUFFER_WRITE);
+				&templ, &buf->winsys, buf->handle_usage);
 		if (!buf->resource)
 			goto fail;
 	}
@@ -159,7 +233,7 @@ static struct pipe_buffer *get_pipe_buffer_locked(struct pipe_manager *pm,
 
 		buf->winsys.type = WINSYS_HANDLE_TYPE_SHARED;
 		if (!pm->screen->resource_get_handle(pm->screen, pm->context,
-				buf->resource, &buf->winsys, PIPE_HANDLE_USAGE_FRAMEBUFFER_WRITE))
+				buf->resource, &buf->winsys, buf->handle_usage))
 			goto fail;
 	}
 
@@ -170,7 +244,7 @@ static struct pipe_buffer *get_pipe_buffer_locked(struct pipe_manager *pm,
 		memset(&tmp, 0, sizeof(tmp));
 		tmp.type = WINSYS_HANDLE_TYPE_KMS;
 		if (!pm->screen->resource_get_handle(pm->screen, pm->context,
-				buf->resource, &tmp, PIPE_HANDLE_USAGE_FRAMEBUFFER_WRITE))
+				buf->resource, &tmp, buf->handle_usage))
 			goto fail;
 
 		buf->base.fb_handle = tmp.handle;
@@ -188,13 +262,20 @@ fail:
 }
 
 static struct gralloc_drm_bo_t *pipe_alloc(struct gralloc_drm_drv_t *drv,
-		struct gralloc_drm_handle_t *handle)
+		struct gralloc_drm_handle_t *handle,
+		const struct gralloc_drm_constraints *constraints)
 {
 	struct pipe_manager *pm = (struct pipe_manager *) drv;
 	struct pipe_buffer *buf;
 
+	if (constraints && constraints->contiguous) {
+		ALOGE("contiguous bos are not supported");
+		return NULL;
+	}
+
+	/* the stride is up to the pipe driver and is checked by the caller */
 	pthread_mutex_lock(&pm->mutex);
-	buf = get_pipe_buffer_locked(pm, handle);
+	buf = get_pipe_buffer_locked(pm, handle, constraints);
 	pthread_mutex_unlock(&pm->mutex);
 
 	if (buf) {
@@ -332,6 +413,9 @@ static void pipe_blit(struct gralloc_drm_drv_t *drv,
 	pm->context->resource_copy_region(pm->context,
 			dst->resource, 0, dst_x1, dst_y1, 0,
 			src->resource, 0, &src_box);
+	/* resolve compression before other users read dst */
+	if (dst->handle_usage & PIPE_HANDLE_USAGE_EXPLICIT_FLUSH)
+		pm->context->flush_resource(pm->context, dst->resource);
 	pm->context->flush(pm->context, NULL, 0);
 
 	pthread_mutex_unlock(&pm->mutex);
@@ -355,21 +439,146 @@ static void pipe_init_kms_features(struct gralloc_drm_drv_t *drv, struct gralloc
 	drm->vblank_secondary = 0;
 }
 
+/*
+ * Get a reference to gallium_dri.so and return its load_pipe_screen, or
+ * NULL.  Called with the mutex of pipe_shared held.
+ */
+static void *pipe_shared_get_gallium_locked(void)
+{
+	void *load_pipe_screen;
+
+	if (!pipe_shared.gallium) {
+		/* reuse the library loaded by EGL */
+		pipe_shared.gallium = dlopen(DRI_LIBRARY_PATH"/gallium_dri.so",
+				RTLD_NOW | RTLD_NOLOAD);
+		if (pipe_shared.gallium)
+			ALOGI("sharing gallium_dri.so with the process");
+		else
+			pipe_shared.gallium = dlopen(DRI_LIBRARY_PATH"/gallium_dri.so",
+					RTLD_NOW | RTLD_GLOBAL);
+		if (!pipe_shared.gallium)
+			return NULL;
+	}
+
+	load_pipe_screen = dlsym(pipe_shared.gallium, "load_pipe_screen");
+	if (!load_pipe_screen) {
+		if (!pipe_shared.gallium_refcount) {
+			dlclose(pipe_shared.gallium);
+			pipe_shared.gallium = NULL;
+		}
+		return NULL;
+	}
+
+	pipe_shared.gallium_refcount++;
+
+	return load_pipe_screen;
+}
+
+/*
+ * Drop a reference to gallium_dri.so.  Called with the mutex of pipe_shared
+ * held.
+ */
+static void pipe_shared_put_gallium_locked(void)
+{
+	if (!--pipe_shared.gallium_refcount) {
+		dlclose(pipe_shared.gallium);
+		pipe_shared.gallium = NULL;
+	}
+}
+
+/*
+ * Get a screen for the fd of a pipe manager.  It is the shared screen,
+ * loaded on first use, unless that one is on another fd.  The manager then
+ * gets a private screen from the same library.
+ */
+static int pipe_shared_get(struct pipe_manager *pm)
+{
+	struct pipe_screen *(*load_pipe_screen)(struct pipe_loader_device **dev, int fd);
+	int err = 0;
+
+	pthread_mutex_lock(&pipe_shared.mutex);
+
+	if (pipe_shared.refcount && pipe_shared.fd == pm->fd) {
+		pipe_shared.refcount++;
+		pipe_shared.gallium_refcount++;
+		pm->screen = pipe_shared.screen;
+		goto out;
+	}
+
+	load_pipe_screen = pipe_shared_get_gallium_locked();
+	if (!load_pipe_screen) {
+		err = -ENOENT;
+		goto out;
+	}
+
+	if (pipe_shared.refcount) {
+		ALOGI("pipe screen is shared on fd %d, creating one for fd %d",
+				pipe_shared.fd, pm->fd);
+		pm->screen = load_pipe_screen(&pm->dev, pm->fd);
+		pm->private_screen = 1;
+	}
+	else {
+		pm->screen = load_pipe_screen(&pipe_shared.dev, pm->fd);
+		if (pm->screen) {
+			pipe_shared.fd = pm->fd;
+			pipe_shared.screen = pm->screen;
+			pipe_shared.refcount = 1;
+		}
+	}
+
+	if (!pm->screen) {
+		pipe_shared_put_gallium_locked();
+		err = -EINVAL;
+	}
+
+out:
+	pthread_mutex_unlock(&pipe_shared.mutex);
+
+	return err;
+}
+
+/*
+ * Drop the screen of a pipe manager.
+ */
+static void pipe_shared_put(struct pipe_manager *pm)
+{
+	pthread_mutex_lock(&pipe_shared.mutex);
+
+	if (pm->private_screen) {
+		pm->screen->destroy(pm->screen);
+	}
+	else if (!--pipe_shared.refcount) {
+		pipe_shared.screen->destroy(pipe_shared.screen);
+		pipe_shared.screen = NULL;
+		pipe_shared.dev = NULL;
+		pipe_shared.fd = -1;
+	}
+	pm->screen = NULL;
+	pipe_shared_put_gallium_locked();
+
+	pthread_mutex_unlock(&pipe_shared.mutex);
+}
+
+static void *pipe_get_pipe_screen(struct gralloc_drm_drv_t *drv)
+{
+	struct pipe_manager *pm = (struct pipe_manager *) drv;
+
+	return pm->screen;
+}
+
 static void pipe_destroy(struct gralloc_drm_drv_t *drv)
 {
 	struct pipe_manager *pm = (struct pipe_manager *) drv;
 
 	if (pm->context)
 		pm->context->destroy(pm->context);
-	pm->screen->destroy(pm->screen);
-	dlclose(pm->gallium);
+	pipe_shared_put(pm);
 	FREE(pm);
 }
 
 struct gralloc_drm_drv_t *gralloc_drm_drv_create_for_pipe(int fd, const char *name)
 {
 	struct pipe_manager *pm;
-	struct pipe_screen *(*load_pipe_screen)(struct pipe_loader_device **dev, int fd);
 
 	pm = CALLOC(1, sizeof(*pm));
 	if (!pm) {
@@ -380,17 +589,11 @@ struct gralloc_drm_drv_t *gralloc_drm_drv_create_for_pipe(int fd, const char *na
 	pm->fd = fd;
 	pthread_mutex_init(&pm->mutex, NULL);
 
-	pm->gallium = dlopen(DRI_LIBRARY_PATH"/gallium_dri.so", RTLD_NOW | RTLD_GLOBAL);
-	if (!pm->gallium)
-		goto err_open;
-
-	load_pipe_screen = dlsym(pm->gallium, "load_pipe_screen");
-	if (!load_pipe_screen)
-		goto err_load;
-
-	pm->screen = load_pipe_screen(&pm->dev, fd);
-	if (!pm->screen)
-		goto err_load;
+	if (pipe_shared_get(pm)) {
+		ALOGE("failed to get a pipe screen for %s", name);
+		FREE(pm);
+		return NULL;
+	}
 
 	pm->base.destroy = pipe_destroy;
 	pm->base.init_kms_features = pipe_init_kms_features;
@@ -399,12 +602,7 @@ struct gralloc_drm_drv_t *gralloc_drm_drv_create_for_pipe(int fd, const char *na
 	pm->base.map = pipe_map;
 	pm->base.unmap = pipe_unmap;
 	pm->base.blit = pipe_blit;
+	pm->base.get_pipe_screen = pipe_get_pipe_screen;
 
 	return &pm->base;
-
-err_load:
-	dlclose(pm->gallium);
-err_open:
-	FREE(pm);
-	return NULL;
 }
@@ -25,9 +25,11 @@
 #define _GRALLOC_DRM_PRIV_H_
 
 #include <pthread.h>
+#include <time.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 
+#include "gralloc_drm.h"
 #include "gralloc_drm_handle.h"
 
 #ifdef __cplusplus
@@ -42,6 +44,70 @@ enum drm_swap_mode {
 	DRM_SWAP_SETCRTC,
 };
 
+/* how a bo is copied to another bo */
+enum drm_copy_engine {
+	DRM_COPY_GPU,
+	DRM_COPY_CPU,
+};
+
+/* display path traffic accounted per frame */
+enum drm_traffic {
+	DRM_TRAFFIC_CLONE,
+	DRM_TRAFFIC_COPY,
+	DRM_TRAFFIC_MAP,
+
+	DRM_TRAFFIC_COUNT
+};
+
+/* operations whose latencies are sampled */
+enum drm_latency {
+	DRM_LATENCY_ALLOC,
+	DRM_LATENCY_IMPORT,
+	DRM_LATENCY_LOCK,
+	DRM_LATENCY_POST,
+	DRM_LATENCY_FLIP, /* from scheduling a flip to its event */
+
+	DRM_LATENCY_COUNT
+};
+
+#define DRM_SHARED_SIZE 4096
+
+/* the page behind gralloc_drm_handle_t::shared_fd */
+struct gralloc_drm_shared {
+	volatile int32_t generation; /* bumped after each write */
+
+	/*
+	 * metadata, guarded by a seqlock that is odd while being written and
+	 * that only the owner of the lock changes
+	 */
+	volatile int32_t metadata_seq;
+	volatile int32_t metadata_owner; /* tid holding the lock, or 0 */
+	uint32_t metadata_mask; /* types that are set */
+	struct gralloc_drm_rect crop;
+	int32_t dataspace;
+	int64_t timestamp;
+	struct gralloc_drm_damage damage;
+	struct gralloc_drm_hdr_metadata hdr;
+};
+
+#define DRM_QUOTA_MAX_CLIENTS 32
+
+/* the use of the quotas by a process bos are allocated for */
+struct gralloc_drm_quota_client {
+	int pid;	/* 0 when the slot is free */
+	uint64_t used[GRALLOC_DRM_QUOTA_COUNT];
+};
+
+#define DRM_IMPORT_CACHE_SIZE 8
+#define DRM_IMPORT_CACHE_MAX_BYTES (64 * 1024 * 1024)
+
+/* an unregistered import kept for a while */
+struct gralloc_drm_cached_import {
+	struct gralloc_drm_bo_t *bo;
+	struct gralloc_drm_handle_t *handle; /* a copy of the original */
+	int64_t time;
+};
+
 enum drm_output_mode {
 	DRM_OUTPUT_PRIMARY,
 	DRM_OUTPUT_CLONED,
@@ -118,16 +184,72 @@ struct gralloc_drm_t {
 	int mode_sync_flip; /* page flip should block */
 	int vblank_secondary;
 
+	/* may be changed by the calibration */
+	enum drm_copy_engine copy_engine;
+	struct gralloc_drm_kms_calibration calibration;
+
 	drmEventContext evctx;
 
 	int first_post;
 	struct gralloc_drm_bo_t *current_front, *next_front;
+
+	/* fronts of DRM_SWAP_COPY, see debug.drm.copy_single_front */
+	struct gralloc_drm_bo_t *copy_fronts[2];
+	int copy_setcrtc; /* flips between the fronts failed */
 	int waiting_flip;
+	int64_t flip_time;
 	unsigned int last_swap;
 
+	/* explicit sync of display copies, under stats_mutex */
+	int present_acquire_fence;	/* for the copies of the next post, or -1 */
+	int present_fence;		/* of the copies of the last post, or -1 */
+
+	/* fences of the post in progress, see drm_kms_post_copy */
+	int post_fenced;
+	int post_acquire_fence;		/* waited on by all its copies */
+	int post_fence;			/* merged out fences of its copies */
+	int post_copies;
+
 	/* plane support */
 	drmModePlaneResPtr plane_resources;
 	struct gralloc_drm_plane_t *planes;
+
+	/* allocation accounting of local bos */
+	struct gralloc_drm_alloc_stats alloc_stats;
+
+	/* display path traffic since the last reset */
+	pthread_mutex_t stats_mutex;
+	uint32_t traffic_frames;
+	uint64_t traffic[DRM_TRAFFIC_COUNT];
+
+	/* CPU locks, also under stats_mutex */
+	struct gralloc_drm_bo_t *locked_bos;
+	struct gralloc_drm_histogram lock_hold;
+	uint32_t long_locks;
+	uint32_t lock_watchdog_ms;
+	int lock_watchdog_started, lock_watchdog_stop;
+	pthread_t lock_watchdog;
+	pthread_cond_t lock_watchdog_cond;
+
+	/* resources and latencies, also under stats_mutex */
+	uint32_t imported_bos;
+	uint32_t fb_count;
+	struct gralloc_drm_histogram latency[DRM_LATENCY_COUNT];
+
+	/* quotas of local bos, per client, also under stats_mutex */
+	uint64_t quota_limit[GRALLOC_DRM_QUOTA_COUNT];
+	uint64_t quota_used[GRALLOC_DRM_QUOTA_COUNT];
+	struct gralloc_drm_quota_client quota_clients[DRM_QUOTA_MAX_CLIENTS];
+	uint32_t quota_hits[GRALLOC_DRM_QUOTA_COUNT];
+	uint32_t quota_reclaims;
+
+	/* unregistered imports, see debug.drm.import_cache_ms */
+	pthread_mutex_t import_cache_mutex;
+	struct gralloc_drm_cached_import import_cache[DRM_IMPORT_CACHE_SIZE];
+	int import_cache_count;
+	uint64_t import_cache_bytes;
+	uint32_t import_cache_hits;
+	int64_t import_cache_grace; /* in ns, 0 when disabled */
 };
 
 struct drm_module_t {
@@ -154,9 +276,10 @@ struct gralloc_drm_drv_t {
 	void (*init_kms_features)(struct gralloc_drm_drv_t *drv,
 				  struct gralloc_drm_t *drm);
 
-	/* allocate or import a bo */
+	/* allocate or import a bo, constraints are NULL for imports */
 	struct gralloc_drm_bo_t *(*alloc)(struct gralloc_drm_drv_t *drv,
-			                  struct gralloc_drm_handle_t *handle);
+			                  struct gralloc_drm_handle_t *handle,
+					  const struct gralloc_drm_constraints *constraints);
 
 	/* free a bo */
 	void (*free)(struct gralloc_drm_drv_t *drv,
@@ -180,10 +303,35 @@ struct gralloc_drm_drv_t {
 		     uint16_t src_x1, uint16_t src_y1,
 		     uint16_t src_x2, uint16_t src_y2);
 
+	/*
+	 * blit after in_fence (-1 for none) signals and return a sync_file
+	 * signaled on completion in out_fence when it is not NULL; optional,
+	 * -ENOSYS when the kernel lacks explicit sync
+	 */
+	int (*blit_fenced)(struct gralloc_drm_drv_t *drv,
+			   struct gralloc_drm_bo_t *dst,
+			   struct gralloc_drm_bo_t *src,
+			   uint16_t dst_x1, uint16_t dst_y1,
+			   uint16_t dst_x2, uint16_t dst_y2,
+			   uint16_t src_x1, uint16_t src_y1,
+			   uint16_t src_x2, uint16_t src_y2,
+			   int in_fence, int *out_fence);
+
 	/* query component offsets, strides and handles for a format */
 	void (*resolve_format)(struct gralloc_drm_drv_t *drv,
 		     struct gralloc_drm_bo_t *bo,
 		     uint32_t *pitches, uint32_t *offsets, uint32_t *handles);
+
+	/* attach a fence to a bo, to be signaled by signal_fence; optional */
+	int (*attach_fence)(struct gralloc_drm_drv_t *drv,
+			    struct gralloc_drm_bo_t *bo,
+			    int write, uint32_t *fence);
+
+	/* signal a fence returned by attach_fence; optional */
+	int (*signal_fence)(struct gralloc_drm_drv_t *drv, uint32_t fence);
+
+	/* return the gallium pipe_screen of the driver; optional */
+	void *(*get_pipe_screen)(struct gralloc_drm_drv_t *drv);
 };
 
 struct gralloc_drm_bo_t {
@@ -193,19 +341,73 @@ struct gralloc_drm_bo_t {
 	int imported;  /* the handle is from a remote proces when true */
 	int fb_handle; /* the GEM handle of the bo */
 	int fb_id;     /* the fb id */
+	uint64_t modifier; /* the DRM format modifier, 0 when implied */
+	size_t size;   /* the real size of the bo, set by the driver */
+
+	struct gralloc_drm_shared *shared; /* mapped shared_fd */
+	int pooled; /* from gralloc_drm_alloc_video_pool */
+	int quota_client; /* the pid the bo is charged to */
 
 	int lock_count;
 	int locked_for;
 
+	/* lock tracking, under drm->stats_mutex */
+	int64_t lock_time;
+	int lock_tid;
+	int lock_reported;
+	struct gralloc_drm_bo_t *lock_prev, *lock_next;
+
 	unsigned int refcount;
 };
 
+unsigned long gralloc_drm_large_page_align(unsigned long *size);
+void gralloc_drm_flush_import_cache(struct gralloc_drm_t *drm);
+void gralloc_drm_histogram_add(struct gralloc_drm_histogram *hist, uint64_t us);
+void gralloc_drm_add_latency(struct gralloc_drm_t *drm, enum drm_latency op, int64_t start);
+void gralloc_drm_add_traffic(struct gralloc_drm_t *drm, enum drm_traffic traffic, uint64_t bytes);
+
+/*
+ * Return a monotonic timestamp in nanoseconds.
+ */
+static inline int64_t gralloc_drm_get_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Align a width so that a pitch of width * cpp satisfies the constraints.
+ */
+static inline int gralloc_drm_constrain_width(
+		const struct gralloc_drm_constraints *constraints,
+		int cpp, int width)
+{
+	uint32_t align;
+
+	if (!constraints || !constraints->stride_align)
+		return width;
+
+	/* divide by the power of two in cpp */
+	align = constraints->stride_align;
+	while (align > 1 && !(cpp & 1)) {
+		align >>= 1;
+		cpp >>= 1;
+	}
+
+	return ALIGN(width, (int) align);
+}
+
 struct gralloc_drm_drv_t *gralloc_drm_drv_create_for_pipe(int fd, const char *name);
 
 struct gralloc_drm_drv_t *gralloc_drm_drv_create_for_freedreno(int fd);
 struct gralloc_drm_drv_t *gralloc_drm_drv_create_for_intel(int fd);
 struct gralloc_drm_drv_t *gralloc_drm_drv_create_for_radeon(int fd);
 struct gralloc_drm_drv_t *gralloc_drm_drv_create_for_nouveau(int fd);
+struct gralloc_drm_drv_t *gralloc_drm_drv_create_for_dumb(int fd);
+struct gralloc_drm_drv_t *gralloc_drm_drv_create_for_vgem(int fd);
 
 #ifdef __cplusplus
 }
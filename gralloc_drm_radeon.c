@@ -122,7 +122,18 @@ static int radeon_get_height_align(struct radeon_info *info, uint32_t tiling)
 {
 	int height_align = 1;
 
-	if (info->chip_family >= CHIP_FAMILY_R600) {
+	if (info->chip_family >= CHIP_FAMILY_CEDAR &&
+	    (tiling & RADEON_TILING_MACRO)) {
+		/* a macro tile is nbanks * bankh / mtilea micro tiles high */
+		int bankh = 1 << ((tiling >> RADEON_TILING_EG_BANKH_SHIFT) &
+				RADEON_TILING_EG_BANKH_MASK);
+		int mtilea = 1 << ((tiling >>
+					RADEON_TILING_EG_MACRO_TILE_ASPECT_SHIFT) &
+				RADEON_TILING_EG_MACRO_TILE_ASPECT_MASK);
+
+		height_align = MAX(8 * info->num_banks * bankh / mtilea, 8);
+	}
+	else if (info->chip_family >= CHIP_FAMILY_R600) {
 		if (tiling & RADEON_TILING_MACRO)
 			height_align =  info->num_channels * 8;
 		else if (tiling & RADEON_TILING_MICRO)
@@ -167,26 +178,69 @@ static int radeon_get_base_align(struct radeon_info *info,
         return base_align;
 }
 
+/*
+ * Return the tiling flags of an evergreen macro-tiled surface, with one
+ * bank per tile in both directions and tiles split at the DRAM row size.
+ */
+static uint32_t radeon_get_eg_macro_flags(struct radeon_info *info)
+{
+	/* 0: 64 bytes, ..., 4: 1KB, 5: 2KB, 6: 4KB */
+	uint32_t tile_split = 4 + ((info->tile_config & 0xf000) >> 12);
+
+	if (tile_split > 6)
+		tile_split = 6;
+
+	return (0 << RADEON_TILING_EG_BANKW_SHIFT) |
+		(0 << RADEON_TILING_EG_BANKH_SHIFT) |
+		(0 << RADEON_TILING_EG_MACRO_TILE_ASPECT_SHIFT) |
+		(tile_split << RADEON_TILING_EG_TILE_SPLIT_SHIFT);
+}
+
 static uint32_t radeon_get_tiling(struct radeon_info *info,
-		const struct gralloc_drm_handle_t *handle)
+		const struct gralloc_drm_handle_t *handle,
+		int width, int height, int cpp)
 {
 	int sw = (GRALLOC_USAGE_SW_WRITE_MASK | GRALLOC_USAGE_SW_READ_MASK);
 
+	if (handle->format == HAL_PIXEL_FORMAT_BLOB)
+		return 0;
+
 	if ((handle->usage & sw) && !info->allow_color_tiling)
 		return 0;
 
-	if (info->chip_family >= CHIP_FAMILY_R600)
-		return RADEON_TILING_MICRO;
-	else
+	if (info->chip_family < CHIP_FAMILY_R600)
 		return RADEON_TILING_MACRO;
+
+	/*
+	 * 2D tiling for scanout and render targets, which the display engine
+	 * reads from up to ARUBA.  SI and later describe tiling with tile
+	 * mode indices instead.
+	 */
+	if ((handle->usage & (GRALLOC_USAGE_HW_FB | GRALLOC_USAGE_HW_RENDER)) &&
+	    info->have_tiling_info &&
+	    info->chip_family <= CHIP_FAMILY_ARUBA) {
+		uint32_t tiling = RADEON_TILING_MACRO;
+
+		if (info->chip_family >= CHIP_FAMILY_CEDAR)
+			tiling |= radeon_get_eg_macro_flags(info);
+
+		/* at least one macro tile */
+		if (width >= radeon_get_pitch_align(info, cpp, tiling) &&
+		    height >= radeon_get_height_align(info, tiling))
+			return tiling;
+	}
+
+	return RADEON_TILING_MICRO;
 }
 
 static struct radeon_bo *radeon_alloc(struct radeon_info *info,
-		struct gralloc_drm_handle_t *handle)
+		struct gralloc_drm_handle_t *handle,
+		const struct gralloc_drm_constraints *constraints)
 {
 	struct radeon_bo *rbo;
 	int aligned_width, aligned_height;
 	int pitch, size, base_align;
+	unsigned long large_size, large_align;
 	uint32_t tiling, domain;
 	int cpp;
 
@@ -196,30 +250,54 @@ static struct radeon_bo *radeon_alloc(struct radeon_info *info,
 		return NULL;
 	}
 
-	tiling = radeon_get_tiling(info, handle);
-	domain = RADEON_GEM_DOMAIN_VRAM;
+	if (constraints && constraints->contiguous) {
+		ALOGE("contiguous bos are not supported");
+		return NULL;
+	}
 
 	aligned_width = handle->width;
 	aligned_height = handle->height;
 	gralloc_drm_align_geometry(handle->format,
 			&aligned_width, &aligned_height);
 
-	if (handle->usage & (GRALLOC_USAGE_HW_FB | GRALLOC_USAGE_HW_TEXTURE)) {
+	tiling = radeon_get_tiling(info, handle,
+			aligned_width, aligned_height, cpp);
+	if (constraints && constraints->linear)
+		tiling = 0;
+	domain = RADEON_GEM_DOMAIN_VRAM;
+
+	/* tiled surfaces are made of whole tiles */
+	if ((handle->usage & (GRALLOC_USAGE_HW_FB | GRALLOC_USAGE_HW_TEXTURE)) ||
+	    tiling) {
 		aligned_width = ALIGN(aligned_width,
 				radeon_get_pitch_align(info, cpp, tiling));
 		aligned_height = ALIGN(aligned_height,
 				radeon_get_height_align(info, tiling));
 	}
+	aligned_width = gralloc_drm_constrain_width(constraints, cpp,
+			aligned_width);
 
 	if (!(handle->usage & (GRALLOC_USAGE_HW_FB |
 			       GRALLOC_USAGE_HW_RENDER)) &&
 	    (handle->usage & GRALLOC_USAGE_SW_READ_OFTEN))
 		domain = RADEON_GEM_DOMAIN_GTT;
 
+	/* byte buffers are written by codecs and read back by the CPU */
+	if (handle->format == HAL_PIXEL_FORMAT_BLOB)
+		domain = RADEON_GEM_DOMAIN_GTT;
+
 	pitch = aligned_width * cpp;
 	size = ALIGN(aligned_height * pitch, RADEON_GPU_PAGE_SIZE);
 	base_align = radeon_get_base_align(info, cpp, tiling);
 
+	/* let the VM use large fragments for big buffers */
+	large_size = size;
+	large_align = gralloc_drm_large_page_align(&large_size);
+	if (large_align) {
+		size = large_size;
+		base_align = MAX(base_align, (int) large_align);
+	}
+
 	rbo = radeon_bo_open(info->bufmgr, 0, size, base_align, domain, 0);
 	if (!rbo) {
 		ALOGE("failed to allocate rbo %dx%dx%d",
@@ -253,7 +331,8 @@ static void radeon_zero(struct radeon_info *info,
 }
 
 static struct gralloc_drm_bo_t *
-drm_gem_radeon_alloc(struct gralloc_drm_drv_t *drv, struct gralloc_drm_handle_t *handle)
+drm_gem_radeon_alloc(struct gralloc_drm_drv_t *drv, struct gralloc_drm_handle_t *handle,
+		const struct gralloc_drm_constraints *constraints)
 {
 	struct radeon_info *info = (struct radeon_info *) drv;
 	struct radeon_buffer *rbuf;
@@ -273,7 +352,7 @@ drm_gem_radeon_alloc(struct gralloc_drm_drv_t *drv, struct gralloc_drm_handle_t
 		}
 	}
 	else {
-		rbuf->rbo = radeon_alloc(info, handle);
+		rbuf->rbo = radeon_alloc(info, handle, constraints);
 		if (!rbuf->rbo) {
 			free(rbuf);
 			return NULL;
@@ -285,6 +364,7 @@ drm_gem_radeon_alloc(struct gralloc_drm_drv_t *drv, struct gralloc_drm_handle_t
 
 	if (handle->usage & GRALLOC_USAGE_HW_FB)
 		rbuf->base.fb_handle = rbuf->rbo->handle;
+	rbuf->base.size = rbuf->rbo->size;
 
 	rbuf->base.handle = handle;
 
@@ -0,0 +1,338 @@
+/*
+ * Copyright (C) 2010-2011 Chia-I Wu <olvaffe@gmail.com>
+ * Copyright (C) 2010-2011 LunarG Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Map benchmark, meant for Intel: lock, touch and unlock linear buffers with
+ * debug.drm.intel_map_wc off and on, and report the time per iteration and
+ * the lock latencies.  Off, scanout bos are mapped through the GTT and
+ * other bos through the CPU cache; on, both are mapped WC.  The bos are
+ * allocated linear, and checked to be, because tiled bos go through the GTT
+ * either way.  Each setting runs in its own process because it is read when
+ * the driver is created.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <errno.h>
+#include <cutils/properties.h>
+#include <xf86drm.h>
+#include <i915_drm.h>
+
+#include "gralloc_drm_test.h"
+
+static const char *bench_settings[] = { "0", "1" };
+
+static const struct bench_case {
+	const char *name;
+	const char *paths;	/* the maps used with the setting off and on */
+	int usage;
+	int write;
+} bench_cases[] = {
+	{ "linear write", "cpu/wc", GRALLOC_USAGE_HW_TEXTURE |
+		GRALLOC_USAGE_SW_WRITE_OFTEN, 1 },
+	{ "linear read", "cpu/wc", GRALLOC_USAGE_HW_TEXTURE |
+		GRALLOC_USAGE_SW_READ_RARELY, 0 },
+	{ "scanout write", "gtt/wc", GRALLOC_USAGE_HW_FB |
+		GRALLOC_USAGE_HW_RENDER | GRALLOC_USAGE_SW_WRITE_OFTEN, 1 },
+};
+
+/* sent from a setting's process to the parent */
+struct bench_result {
+	int failed;
+	struct {
+		uint64_t avg_us;
+		uint64_t p99_us;
+		uint64_t lock_p50_us;
+		uint64_t lock_p99_us;
+	} cases[ARRAY_SIZE(bench_cases)];
+};
+
+struct bench {
+	int width;
+	int height;
+	int iterations;
+
+	struct gralloc_drm_test t;
+};
+
+/* a setting to run in a new process */
+struct bench_setting_run {
+	struct bench *b;
+	int setting;
+};
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * Get the tiling of a bo from the kernel.
+ */
+static int bench_get_tiling(struct bench *b, buffer_handle_t buf,
+		uint32_t *tiling)
+{
+	struct gralloc_drm_handle_t *handle = gralloc_drm_handle(buf);
+	struct drm_i915_gem_get_tiling get_tiling;
+	struct drm_gem_open open_arg;
+	struct drm_gem_close close_arg;
+	int fd, err;
+
+	if (b->t.mod->perform(b->t.mod, GRALLOC_MODULE_PERFORM_GET_DRM_FD, &fd))
+		return -EINVAL;
+
+	/* a handle of our own, closed when done */
+	memset(&open_arg, 0, sizeof(open_arg));
+	open_arg.name = handle->name;
+	if (drmIoctl(fd, DRM_IOCTL_GEM_OPEN, &open_arg))
+		return -errno;
+
+	memset(&get_tiling, 0, sizeof(get_tiling));
+	get_tiling.handle = open_arg.handle;
+	err = (drmIoctl(fd, DRM_IOCTL_I915_GEM_GET_TILING, &get_tiling)) ?
+		-errno : 0;
+	if (!err)
+		*tiling = get_tiling.tiling_mode;
+
+	memset(&close_arg, 0, sizeof(close_arg));
+	close_arg.handle = open_arg.handle;
+	drmIoctl(fd, DRM_IOCTL_GEM_CLOSE, &close_arg);
+
+	return err;
+}
+
+static int bench_alloc(struct bench *b, const struct bench_case *c,
+		buffer_handle_t *buf, int *stride)
+{
+	struct gralloc_drm_constraints linear;
+	uint32_t tiling = I915_TILING_NONE;
+	int err;
+
+	memset(&linear, 0, sizeof(linear));
+	linear.linear = 1;
+
+	err = b->t.mod->perform(b->t.mod,
+			GRALLOC_MODULE_PERFORM_ALLOC_CONSTRAINED,
+			b->width, b->height, HAL_PIXEL_FORMAT_RGBA_8888,
+			c->usage, &linear, 1, buf, stride);
+	if (err) {
+		fprintf(stderr, "failed to create a %s buffer: %d\n",
+				c->name, err);
+		return err;
+	}
+
+	err = bench_get_tiling(b, *buf, &tiling);
+	if (!err && tiling != I915_TILING_NONE)
+		err = -EINVAL;
+	if (err) {
+		fprintf(stderr, "%s buffer is not linear: %d, tiling %u\n",
+				c->name, err, tiling);
+		b->t.alloc->free(b->t.alloc, *buf);
+		return err;
+	}
+
+	return 0;
+}
+
+static int bench_case(struct bench *b, const struct bench_case *c,
+		struct bench_result *res, int idx)
+{
+	const gralloc_module_t *mod = b->t.mod;
+	struct gralloc_drm_resource_stats st;
+	buffer_handle_t buf;
+	uint64_t *samples, total = 0;
+	volatile uint32_t sum = 0;
+	int stride, i, y, err;
+
+	err = bench_alloc(b, c, &buf, &stride);
+	if (err)
+		return err;
+
+	samples = calloc(b->iterations, sizeof(*samples));
+	if (!samples) {
+		b->t.alloc->free(b->t.alloc, buf);
+		return -ENOMEM;
+	}
+
+	mod->perform(mod, GRALLOC_MODULE_PERFORM_GET_RESOURCE_STATS, &st, 1);
+
+	for (i = 0; i < b->iterations; i++) {
+		int64_t t0 = test_get_time_ns();
+		uint8_t *ptr;
+
+		err = mod->lock(mod, buf, c->usage &
+				(GRALLOC_USAGE_SW_READ_MASK |
+				 GRALLOC_USAGE_SW_WRITE_MASK), 0, 0,
+				b->width, b->height, (void **) &ptr);
+		if (err) {
+			fprintf(stderr, "failed to lock a %s buffer: %d\n",
+					c->name, err);
+			break;
+		}
+
+		/* touch a word per cache line, as a copy would */
+		for (y = 0; y < b->height; y++) {
+			uint32_t *row = (uint32_t *) (ptr + y * stride * 4);
+			int x;
+
+			for (x = 0; x < b->width; x += 16) {
+				if (c->write)
+					row[x] = i;
+				else
+					sum += row[x];
+			}
+		}
+
+		mod->unlock(mod, buf);
+		samples[i] = (test_get_time_ns() - t0) / 1000;
+		total += samples[i];
+	}
+
+	mod->perform(mod, GRALLOC_MODULE_PERFORM_GET_RESOURCE_STATS, &st, 0);
+
+	if (!err) {
+		qsort(samples, b->iterations, sizeof(*samples), cmp_u64);
+		res->cases[idx].avg_us = total / b->iterations;
+		res->cases[idx].p99_us =
+			samples[(b->iterations * 99 + 99) / 100 - 1];
+		res->cases[idx].lock_p50_us =
+			gralloc_drm_histogram_percentile(&st.lock, 50);
+		res->cases[idx].lock_p99_us =
+			gralloc_drm_histogram_percentile(&st.lock, 99);
+	}
+
+	free(samples);
+	b->t.alloc->free(b->t.alloc, buf);
+
+	return err;
+}
+
+/*
+ * Run all cases with one setting.  Called in a new process, before
+ * gralloc.drm is loaded.
+ */
+static void bench_setting(void *data, void *result)
+{
+	const struct bench_setting_run *run = data;
+	struct bench_result *res = result;
+	struct bench *b = run->b;
+	int i;
+
+	memset(res, 0, sizeof(*res));
+
+	if (property_set("debug.drm.intel_map_wc",
+				bench_settings[run->setting])) {
+		fprintf(stderr, "failed to set debug.drm.intel_map_wc\n");
+		res->failed = 1;
+		return;
+	}
+
+	if (test_open(&b->t, 0)) {
+		res->failed = 1;
+		return;
+	}
+
+	for (i = 0; i < (int) ARRAY_SIZE(bench_cases); i++) {
+		if (bench_case(b, &bench_cases[i], res, i))
+			res->failed = 1;
+	}
+
+	test_close(&b->t);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -s WxH       buffer size (default 1920x1080)\n"
+		"  -n COUNT     lock/unlock iterations per case (default 200)\n",
+		prog);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_result results[ARRAY_SIZE(bench_settings)];
+	struct bench b;
+	int opt, i, j, ret = 0;
+
+	memset(&b, 0, sizeof(b));
+	b.width = 1920;
+	b.height = 1080;
+	b.iterations = 200;
+
+	while ((opt = getopt(argc, argv, "s:n:h")) != -1) {
+		switch (opt) {
+		case 's':
+			if (sscanf(optarg, "%dx%d", &b.width, &b.height) != 2)
+				b.width = 0;
+			break;
+		case 'n':
+			b.iterations = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return 2;
+		}
+	}
+
+	if (b.width <= 0 || b.height <= 0 || b.iterations <= 0) {
+		usage(argv[0]);
+		return 2;
+	}
+
+	for (i = 0; i < (int) ARRAY_SIZE(bench_settings); i++) {
+		struct bench_result *res = &results[i];
+		struct bench_setting_run run = { &b, i };
+
+		if (test_run_forked(bench_setting, &run, res, sizeof(*res))) {
+			printf("map_wc=%s crashed\n", bench_settings[i]);
+			ret = 1;
+			continue;
+		}
+		if (res->failed)
+			ret = 1;
+
+		for (j = 0; j < (int) ARRAY_SIZE(bench_cases); j++) {
+			const struct bench_case *c = &bench_cases[j];
+
+			printf("map_wc=%s %-14s (%s) avg %llu us p99 %llu us "
+				"lock p50 %llu us p99 %llu us\n",
+				bench_settings[i], c->name, c->paths,
+				(unsigned long long) res->cases[j].avg_us,
+				(unsigned long long) res->cases[j].p99_us,
+				(unsigned long long) res->cases[j].lock_p50_us,
+				(unsigned long long) res->cases[j].lock_p99_us);
+		}
+	}
+
+	/* do not leave the setting for the compositor */
+	property_set("debug.drm.intel_map_wc", "");
+
+	printf("%s\n", (ret) ? "FAIL" : "PASS");
+
+	return ret;
+}
@@ -0,0 +1,387 @@
+/*
+ * Copyright (C) 2010-2011 Chia-I Wu <olvaffe@gmail.com>
+ * Copyright (C) 2010-2011 LunarG Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Present benchmark, meant for vkms: post at full rate in every swap mode,
+ * report the post and flip latencies and the frame rate, and check with the
+ * CRTC CRCs that the frames shown are the frames posted.  Each swap mode runs
+ * in its own process because the mode is picked when KMS is initialized.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <errno.h>
+#include <cutils/properties.h>
+
+#include "gralloc_drm_test.h"
+
+#define BENCH_PATTERNS 3
+#define BENCH_MAX_CRCS 4
+/* frames to wait for a posted buffer to show up */
+#define BENCH_VERIFY_FRAMES 4
+
+/* in the order of enum drm_swap_mode, which starts with a no-op mode */
+static const char *bench_modes[] = { "flip", "copy", "set-crtc" };
+
+/* sent from a mode's process to the parent */
+struct bench_result {
+	int ran;	/* 0 if the mode is not supported */
+	int failed;
+	int crc_count;
+	uint32_t crcs[BENCH_PATTERNS][BENCH_MAX_CRCS];
+	double fps;
+	uint64_t post_avg_us;
+	uint64_t post_p99_us;
+	uint64_t flip_p50_us;
+	uint64_t flip_p99_us;
+	uint32_t mismatches;
+};
+
+struct bench {
+	int frames;
+	int verify_every;
+
+	struct gralloc_drm_test t;
+	buffer_handle_t bufs[BENCH_PATTERNS];
+	int strides[BENCH_PATTERNS];
+};
+
+static int bench_fill(struct bench *b, int i)
+{
+	const gralloc_module_t *mod = b->t.mod;
+	framebuffer_device_t *fb = b->t.fb;
+	uint8_t *ptr;
+	int y, err;
+
+	err = mod->lock(mod, b->bufs[i], GRALLOC_USAGE_SW_WRITE_OFTEN,
+			0, 0, fb->width, fb->height, (void **) &ptr);
+	if (err)
+		return err;
+
+	/* a distinct solid value per buffer, whatever the format */
+	for (y = 0; y < (int) fb->height; y++)
+		memset(ptr + y * b->strides[i] * 4, 0x20 + 0x40 * i,
+				fb->width * 4);
+
+	return mod->unlock(mod, b->bufs[i]);
+}
+
+static int bench_init_buffers(struct bench *b)
+{
+	framebuffer_device_t *fb = b->t.fb;
+	int i, err;
+
+	if (fb->format != HAL_PIXEL_FORMAT_RGBA_8888 &&
+	    fb->format != HAL_PIXEL_FORMAT_RGBX_8888 &&
+	    fb->format != HAL_PIXEL_FORMAT_BGRA_8888) {
+		fprintf(stderr, "unsupported fb format 0x%x\n", fb->format);
+		return -EINVAL;
+	}
+
+	for (i = 0; i < BENCH_PATTERNS; i++) {
+		err = b->t.alloc->alloc(b->t.alloc, fb->width, fb->height,
+				fb->format, GRALLOC_USAGE_HW_FB |
+				GRALLOC_USAGE_HW_RENDER |
+				GRALLOC_USAGE_SW_WRITE_OFTEN,
+				&b->bufs[i], &b->strides[i]);
+		if (!err)
+			err = bench_fill(b, i);
+		if (err) {
+			fprintf(stderr, "failed to create buffer %d: %d\n", i, err);
+			return err;
+		}
+	}
+
+	return 0;
+}
+
+static void bench_fini_buffers(struct bench *b)
+{
+	int i;
+
+	for (i = 0; i < BENCH_PATTERNS; i++) {
+		if (b->bufs[i])
+			b->t.alloc->free(b->t.alloc, b->bufs[i]);
+	}
+}
+
+static int bench_read_crc(struct bench *b, uint32_t *crcs)
+{
+	uint32_t frame;
+
+	memset(crcs, 0, sizeof(uint32_t) * BENCH_MAX_CRCS);
+
+	return b->t.mod->perform(b->t.mod, GRALLOC_MODULE_PERFORM_GET_CRTC_CRC,
+			&frame, crcs, BENCH_MAX_CRCS);
+}
+
+/*
+ * Post each buffer and let it settle, so that every pattern has a CRC
+ * produced by a frame that is known to be complete.
+ */
+static int bench_reference(struct bench *b, struct bench_result *res)
+{
+	uint32_t crcs[BENCH_MAX_CRCS];
+	int i, j, n;
+
+	for (i = 0; i < BENCH_PATTERNS; i++) {
+		if (b->t.fb->post(b->t.fb, b->bufs[i]))
+			return -EIO;
+
+		/* skip the frame the post may land in */
+		for (j = 0; j < 2; j++) {
+			n = bench_read_crc(b, crcs);
+			if (n <= 0) {
+				fprintf(stderr, "failed to read CRCs: %d\n", n);
+				return (n) ? n : -EIO;
+			}
+		}
+
+		memcpy(res->crcs[i], crcs, sizeof(crcs));
+		res->crc_count = n;
+	}
+
+	for (i = 1; i < BENCH_PATTERNS; i++) {
+		if (!memcmp(res->crcs[i], res->crcs[0],
+				sizeof(uint32_t) * res->crc_count)) {
+			fprintf(stderr, "patterns have the same CRC\n");
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Check that a buffer posted right after a burst shows up within a few
+ * frames.  Skipped flips or stale copies would show an older pattern.
+ */
+static int bench_verify(struct bench *b, struct bench_result *res, int i)
+{
+	uint32_t crcs[BENCH_MAX_CRCS];
+	int j, n;
+
+	for (j = 0; j < BENCH_VERIFY_FRAMES; j++) {
+		n = bench_read_crc(b, crcs);
+		if (n <= 0)
+			return (n) ? n : -EIO;
+		if (!memcmp(crcs, res->crcs[i], sizeof(uint32_t) * res->crc_count))
+			return 0;
+	}
+
+	res->mismatches++;
+
+	return -EINVAL;
+}
+
+static int bench_run(struct bench *b, struct bench_result *res)
+{
+	struct gralloc_drm_resource_stats st;
+	int64_t start, elapsed, post_ns = 0, t0;
+	int i;
+
+	b->t.mod->perform(b->t.mod,
+			GRALLOC_MODULE_PERFORM_GET_RESOURCE_STATS, &st, 1);
+
+	start = test_get_time_ns();
+	for (i = 0; i < b->frames; i++) {
+		int idx = i % BENCH_PATTERNS;
+
+		t0 = test_get_time_ns();
+		if (b->t.fb->post(b->t.fb, b->bufs[idx])) {
+			fprintf(stderr, "failed to post frame %d\n", i);
+			return -EIO;
+		}
+		post_ns += test_get_time_ns() - t0;
+
+		/* the CRC reads stall the burst, so do not count them */
+		if (b->verify_every && (i + 1) % b->verify_every == 0) {
+			int64_t v0 = test_get_time_ns();
+
+			bench_verify(b, res, idx);
+			start += test_get_time_ns() - v0;
+		}
+	}
+	elapsed = test_get_time_ns() - start;
+
+	/* the last frame must always show up */
+	bench_verify(b, res, (b->frames - 1) % BENCH_PATTERNS);
+
+	b->t.mod->perform(b->t.mod,
+			GRALLOC_MODULE_PERFORM_GET_RESOURCE_STATS, &st, 0);
+
+	res->fps = (double) b->frames * 1000000000 / elapsed;
+	res->post_avg_us = post_ns / b->frames / 1000;
+	res->post_p99_us = gralloc_drm_histogram_percentile(&st.post, 99);
+	res->flip_p50_us = gralloc_drm_histogram_percentile(&st.flip, 50);
+	res->flip_p99_us = gralloc_drm_histogram_percentile(&st.flip, 99);
+	res->failed = (res->mismatches != 0);
+
+	return 0;
+}
+
+/* a swap mode to run in a new process */
+struct bench_mode_run {
+	struct bench *b;
+	int mode;
+};
+
+/*
+ * Run one swap mode.  Called in a new process, before gralloc.drm is
+ * loaded.
+ */
+static void bench_mode(void *data, void *result)
+{
+	const struct bench_mode_run *run = data;
+	struct bench_result *res = result;
+	struct bench *b = run->b;
+	int mode = run->mode;
+	struct gralloc_drm_kms_calibration cal;
+
+	memset(res, 0, sizeof(*res));
+
+	if (property_set("debug.drm.swap_mode", bench_modes[mode])) {
+		fprintf(stderr, "failed to set debug.drm.swap_mode\n");
+		res->failed = 1;
+		return;
+	}
+
+	if (test_open(&b->t, 1)) {
+		res->failed = 1;
+		return;
+	}
+
+	/* the mode is ignored when the device cannot do it */
+	if (b->t.mod->perform(b->t.mod,
+			GRALLOC_MODULE_PERFORM_GET_KMS_CALIBRATION, &cal) ||
+			cal.swap_mode != mode + 1) {
+		test_close(&b->t);
+		return;
+	}
+	res->ran = 1;
+
+	if (bench_init_buffers(b) || bench_reference(b, res) ||
+			bench_run(b, res))
+		res->failed = 1;
+
+	bench_fini_buffers(b);
+	test_close(&b->t);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -n FRAMES    frames to post per mode (default 600)\n"
+		"  -v FRAMES    verify a CRC every that many frames, 0 for the "
+		"last only (default 60)\n"
+		"  -m MODE      run only flip, copy or set-crtc\n",
+		prog);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_result results[ARRAY_SIZE(bench_modes)];
+	struct bench b;
+	const struct bench_result *ref = NULL;
+	const char *only = NULL;
+	int opt, i, ret = 0;
+
+	memset(&b, 0, sizeof(b));
+	b.frames = 600;
+	b.verify_every = 60;
+
+	while ((opt = getopt(argc, argv, "n:v:m:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			b.frames = atoi(optarg);
+			break;
+		case 'v':
+			b.verify_every = atoi(optarg);
+			break;
+		case 'm':
+			only = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return 2;
+		}
+	}
+
+	if (b.frames <= 0 || b.verify_every < 0) {
+		usage(argv[0]);
+		return 2;
+	}
+
+	for (i = 0; i < (int) ARRAY_SIZE(bench_modes); i++) {
+		struct bench_result *res = &results[i];
+		struct bench_mode_run run = { &b, i };
+
+		memset(res, 0, sizeof(*res));
+		if (only && strcmp(only, bench_modes[i]))
+			continue;
+
+		if (test_run_forked(bench_mode, &run, res, sizeof(*res))) {
+			printf("%-8s crashed\n", bench_modes[i]);
+			ret = 1;
+			continue;
+		}
+		if (!res->ran) {
+			printf("%-8s not supported\n", bench_modes[i]);
+			continue;
+		}
+
+		printf("%-8s %s fps %.1f post avg %llu us p99 %llu us "
+			"flip p50 %llu us p99 %llu us CRC mismatches %u\n",
+			bench_modes[i], (res->failed) ? "FAIL" : "ok", res->fps,
+			(unsigned long long) res->post_avg_us,
+			(unsigned long long) res->post_p99_us,
+			(unsigned long long) res->flip_p50_us,
+			(unsigned long long) res->flip_p99_us,
+			res->mismatches);
+		if (res->failed) {
+			ret = 1;
+			continue;
+		}
+
+		/* the same pixels must give the same CRCs whatever the path */
+		if (!ref) {
+			ref = res;
+		}
+		else if (res->crc_count != ref->crc_count ||
+				memcmp(res->crcs, ref->crcs, sizeof(res->crcs))) {
+			printf("%-8s CRCs differ from the other modes\n",
+					bench_modes[i]);
+			ret = 1;
+		}
+	}
+
+	/* do not leave the mode forced for the compositor */
+	property_set("debug.drm.swap_mode", "");
+
+	printf("%s\n", (ret) ? "FAIL" : "PASS");
+
+	return ret;
+}
@@ -0,0 +1,465 @@
+/*
+ * Copyright (C) 2010-2011 Chia-I Wu <olvaffe@gmail.com>
+ * Copyright (C) 2010-2011 LunarG Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Sampling benchmark, meant for radeon and nouveau: texture from a big
+ * buffer with GLES and report the sustained sampling bandwidth with
+ * debug.drm.large_pages off and on.  The texels are read in rows and, to
+ * stress the GPU TLB, in columns.  Each setting runs in its own process
+ * because it is read when the device is created, and EGL must import the
+ * buffer through the same gralloc.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <errno.h>
+#include <cutils/properties.h>
+#include <system/window.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+
+#include "gralloc_drm_test.h"
+
+static const char *bench_settings[] = { "0", "1" };
+
+/* texture coordinates of the quad, in rows and in columns */
+static const struct bench_pass {
+	const char *name;
+	GLfloat tc[4];
+} bench_passes[] = {
+	{ "rows", { 1.0f, 0.0f, 0.0f, 1.0f } },
+	{ "columns", { 0.0f, 1.0f, 1.0f, 0.0f } },
+};
+
+static const char bench_vs[] =
+	"attribute vec2 pos;\n"
+	"uniform mat2 tc_matrix;\n"
+	"varying vec2 tc;\n"
+	"void main() {\n"
+	"	tc = tc_matrix * (pos * 0.5 + 0.5);\n"
+	"	gl_Position = vec4(pos, 0.0, 1.0);\n"
+	"}\n";
+
+static const char bench_fs[] =
+	"precision mediump float;\n"
+	"uniform sampler2D tex;\n"
+	"varying vec2 tc;\n"
+	"void main() {\n"
+	"	gl_FragColor = texture2D(tex, tc);\n"
+	"}\n";
+
+/* sent from a setting's process to the parent */
+struct bench_result {
+	int failed;
+	uint64_t allocated;	/* bytes of the texture bo */
+	uint64_t mbps[ARRAY_SIZE(bench_passes)];
+};
+
+struct bench {
+	int width;
+	int height;
+	int draws;
+
+	struct gralloc_drm_test t;
+	buffer_handle_t buf;
+	int stride;
+	ANativeWindowBuffer_t anb;
+
+	EGLDisplay dpy;
+	EGLSurface surf;
+	EGLContext ctx;
+	EGLImageKHR image;
+	GLuint tex, target, fbo, prog;
+};
+
+/* a setting to run in a new process */
+struct bench_setting_run {
+	struct bench *b;
+	int setting;
+};
+
+/* the buffer is owned by the bench, EGL does not need to count refs */
+static void bench_anb_ref(struct android_native_base_t *base)
+{
+}
+
+static int bench_init_egl(struct bench *b)
+{
+	static const EGLint config_attrs[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+		EGL_RED_SIZE, 8,
+		EGL_GREEN_SIZE, 8,
+		EGL_BLUE_SIZE, 8,
+		EGL_NONE
+	};
+	static const EGLint surf_attrs[] = {
+		EGL_WIDTH, 16,
+		EGL_HEIGHT, 16,
+		EGL_NONE
+	};
+	static const EGLint ctx_attrs[] = {
+		EGL_CONTEXT_CLIENT_VERSION, 2,
+		EGL_NONE
+	};
+	EGLConfig config;
+	EGLint count;
+
+	b->dpy = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	if (b->dpy == EGL_NO_DISPLAY || !eglInitialize(b->dpy, NULL, NULL)) {
+		fprintf(stderr, "failed to initialize EGL\n");
+		b->dpy = EGL_NO_DISPLAY;
+		return -ENODEV;
+	}
+
+	if (!eglChooseConfig(b->dpy, config_attrs, &config, 1, &count) ||
+	    !count) {
+		fprintf(stderr, "no EGL config for GLES2 pbuffers\n");
+		return -EINVAL;
+	}
+
+	b->surf = eglCreatePbufferSurface(b->dpy, config, surf_attrs);
+	b->ctx = eglCreateContext(b->dpy, config, EGL_NO_CONTEXT, ctx_attrs);
+	if (b->surf == EGL_NO_SURFACE || b->ctx == EGL_NO_CONTEXT ||
+	    !eglMakeCurrent(b->dpy, b->surf, b->surf, b->ctx)) {
+		fprintf(stderr, "failed to make a GLES2 context current: 0x%x\n",
+				eglGetError());
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static void bench_fini_egl(struct bench *b)
+{
+	if (b->dpy == EGL_NO_DISPLAY)
+		return;
+
+	eglMakeCurrent(b->dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	if (b->ctx != EGL_NO_CONTEXT)
+		eglDestroyContext(b->dpy, b->ctx);
+	if (b->surf != EGL_NO_SURFACE)
+		eglDestroySurface(b->dpy, b->surf);
+	eglTerminate(b->dpy);
+}
+
+static GLuint bench_compile(GLenum type, const char *src)
+{
+	GLuint shader = glCreateShader(type);
+	GLint ok = 0;
+
+	glShaderSource(shader, 1, &src, NULL);
+	glCompileShader(shader);
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+	if (!ok) {
+		glDeleteShader(shader);
+		return 0;
+	}
+
+	return shader;
+}
+
+static int bench_init_program(struct bench *b)
+{
+	GLuint vs, fs;
+	GLint ok = 0;
+
+	vs = bench_compile(GL_VERTEX_SHADER, bench_vs);
+	fs = bench_compile(GL_FRAGMENT_SHADER, bench_fs);
+	if (!vs || !fs) {
+		fprintf(stderr, "failed to compile the shaders\n");
+		return -EINVAL;
+	}
+
+	b->prog = glCreateProgram();
+	glAttachShader(b->prog, vs);
+	glAttachShader(b->prog, fs);
+	glBindAttribLocation(b->prog, 0, "pos");
+	glLinkProgram(b->prog);
+	glDeleteShader(vs);
+	glDeleteShader(fs);
+
+	glGetProgramiv(b->prog, GL_LINK_STATUS, &ok);
+	if (!ok) {
+		fprintf(stderr, "failed to link the program\n");
+		return -EINVAL;
+	}
+
+	glUseProgram(b->prog);
+	glUniform1i(glGetUniformLocation(b->prog, "tex"), 0);
+
+	return 0;
+}
+
+/*
+ * Allocate the texture from gralloc.drm, import it with EGL and make a
+ * render target of the same size.
+ */
+static int bench_init_texture(struct bench *b, struct bench_result *res)
+{
+	PFNEGLCREATEIMAGEKHRPROC create_image = (PFNEGLCREATEIMAGEKHRPROC)
+		eglGetProcAddress("eglCreateImageKHR");
+	PFNGLEGLIMAGETARGETTEXTURE2DOESPROC image_target_texture =
+		(PFNGLEGLIMAGETARGETTEXTURE2DOESPROC)
+		eglGetProcAddress("glEGLImageTargetTexture2DOES");
+	static const EGLint image_attrs[] = {
+		EGL_IMAGE_PRESERVED_KHR, EGL_TRUE,
+		EGL_NONE
+	};
+	uint64_t requested;
+	int err;
+
+	if (!create_image || !image_target_texture) {
+		fprintf(stderr, "EGLImage import is not supported\n");
+		return -ENOSYS;
+	}
+
+	err = b->t.alloc->alloc(b->t.alloc, b->width, b->height,
+			HAL_PIXEL_FORMAT_RGBA_8888, GRALLOC_USAGE_HW_TEXTURE,
+			&b->buf, &b->stride);
+	if (err) {
+		fprintf(stderr, "failed to create the texture: %d\n", err);
+		b->buf = NULL;
+		return err;
+	}
+
+	b->t.mod->perform(b->t.mod, GRALLOC_MODULE_PERFORM_GET_BUFFER_ALLOC_INFO,
+			b->buf, &requested, &res->allocated);
+
+	memset(&b->anb, 0, sizeof(b->anb));
+	b->anb.common.magic = ANDROID_NATIVE_BUFFER_MAGIC;
+	b->anb.common.version = sizeof(b->anb);
+	b->anb.common.incRef = bench_anb_ref;
+	b->anb.common.decRef = bench_anb_ref;
+	b->anb.width = b->width;
+	b->anb.height = b->height;
+	b->anb.stride = b->stride;
+	b->anb.format = HAL_PIXEL_FORMAT_RGBA_8888;
+	b->anb.usage = GRALLOC_USAGE_HW_TEXTURE;
+	b->anb.handle = b->buf;
+
+	b->image = create_image(b->dpy, EGL_NO_CONTEXT,
+			EGL_NATIVE_BUFFER_ANDROID, (EGLClientBuffer) &b->anb,
+			image_attrs);
+	if (b->image == EGL_NO_IMAGE_KHR) {
+		fprintf(stderr, "failed to import the texture: 0x%x\n",
+				eglGetError());
+		return -EINVAL;
+	}
+
+	glActiveTexture(GL_TEXTURE0);
+	glGenTextures(1, &b->tex);
+	glBindTexture(GL_TEXTURE_2D, b->tex);
+	image_target_texture(GL_TEXTURE_2D, (GLeglImageOES) b->image);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	/* one texel per fragment */
+	glGenTextures(1, &b->target);
+	glBindTexture(GL_TEXTURE_2D, b->target);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, b->width, b->height, 0,
+			GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glGenFramebuffers(1, &b->fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, b->fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+			GL_TEXTURE_2D, b->target, 0);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		fprintf(stderr, "the render target is incomplete\n");
+		return -EINVAL;
+	}
+	glBindTexture(GL_TEXTURE_2D, b->tex);
+	glViewport(0, 0, b->width, b->height);
+
+	return 0;
+}
+
+static void bench_fini_texture(struct bench *b)
+{
+	PFNEGLDESTROYIMAGEKHRPROC destroy_image = (PFNEGLDESTROYIMAGEKHRPROC)
+		eglGetProcAddress("eglDestroyImageKHR");
+
+	if (b->fbo)
+		glDeleteFramebuffers(1, &b->fbo);
+	if (b->target)
+		glDeleteTextures(1, &b->target);
+	if (b->tex)
+		glDeleteTextures(1, &b->tex);
+	if (b->prog)
+		glDeleteProgram(b->prog);
+	if (b->image != EGL_NO_IMAGE_KHR && destroy_image)
+		destroy_image(b->dpy, b->image);
+	if (b->buf)
+		b->t.alloc->free(b->t.alloc, b->buf);
+}
+
+/*
+ * Sample the whole texture draws times and return the bandwidth in MB/s.
+ */
+static uint64_t bench_pass(struct bench *b, const struct bench_pass *pass)
+{
+	static const GLfloat quad[] = {
+		-1.0f, -1.0f,
+		1.0f, -1.0f,
+		-1.0f, 1.0f,
+		1.0f, 1.0f,
+	};
+	int64_t start, elapsed;
+	int i;
+
+	glUniformMatrix2fv(glGetUniformLocation(b->prog, "tc_matrix"), 1,
+			GL_FALSE, pass->tc);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, quad);
+	glEnableVertexAttribArray(0);
+
+	/* warm up */
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	glFinish();
+
+	start = test_get_time_ns();
+	for (i = 0; i < b->draws; i++)
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	glFinish();
+	elapsed = test_get_time_ns() - start;
+
+	if (glGetError() != GL_NO_ERROR || elapsed <= 0)
+		return 0;
+
+	return (uint64_t) b->width * b->height * 4 * b->draws * 1000 / elapsed;
+}
+
+/*
+ * Run all passes with one setting.  Called in a new process, before
+ * gralloc.drm and EGL are loaded.
+ */
+static void bench_setting(void *data, void *result)
+{
+	const struct bench_setting_run *run = data;
+	struct bench_result *res = result;
+	struct bench *b = run->b;
+	int i;
+
+	memset(res, 0, sizeof(*res));
+
+	if (property_set("debug.drm.large_pages",
+				bench_settings[run->setting])) {
+		fprintf(stderr, "failed to set debug.drm.large_pages\n");
+		res->failed = 1;
+		return;
+	}
+
+	if (test_open(&b->t, 0)) {
+		res->failed = 1;
+		return;
+	}
+
+	if (!bench_init_egl(b) && !bench_init_program(b) &&
+	    !bench_init_texture(b, res)) {
+		for (i = 0; i < (int) ARRAY_SIZE(bench_passes); i++) {
+			res->mbps[i] = bench_pass(b, &bench_passes[i]);
+			if (!res->mbps[i])
+				res->failed = 1;
+		}
+	}
+	else {
+		res->failed = 1;
+	}
+
+	bench_fini_texture(b);
+	bench_fini_egl(b);
+	test_close(&b->t);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -s WxH       texture size (default 3840x2160)\n"
+		"  -n COUNT     draws per pass (default 200)\n",
+		prog);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_result results[ARRAY_SIZE(bench_settings)];
+	struct bench b;
+	int opt, i, j, ret = 0;
+
+	memset(&b, 0, sizeof(b));
+	b.width = 3840;
+	b.height = 2160;
+	b.draws = 200;
+
+	while ((opt = getopt(argc, argv, "s:n:h")) != -1) {
+		switch (opt) {
+		case 's':
+			if (sscanf(optarg, "%dx%d", &b.width, &b.height) != 2)
+				b.width = 0;
+			break;
+		case 'n':
+			b.draws = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return 2;
+		}
+	}
+
+	if (b.width <= 0 || b.height <= 0 || b.draws <= 0) {
+		usage(argv[0]);
+		return 2;
+	}
+
+	for (i = 0; i < (int) ARRAY_SIZE(bench_settings); i++) {
+		struct bench_result *res = &results[i];
+		struct bench_setting_run run = { &b, i };
+
+		if (test_run_forked(bench_setting, &run, res, sizeof(*res))) {
+			printf("large_pages=%s crashed\n", bench_settings[i]);
+			ret = 1;
+			continue;
+		}
+		if (res->failed)
+			ret = 1;
+
+		printf("large_pages=%s %s bo %llu bytes", bench_settings[i],
+				(res->failed) ? "FAIL" : "ok",
+				(unsigned long long) res->allocated);
+		for (j = 0; j < (int) ARRAY_SIZE(bench_passes); j++)
+			printf(" %s %llu MB/s", bench_passes[j].name,
+					(unsigned long long) res->mbps[j]);
+		printf("\n");
+	}
+
+	/* do not leave the setting for the compositor */
+	property_set("debug.drm.large_pages", "");
+
+	printf("%s\n", (ret) ? "FAIL" : "PASS");
+
+	return ret;
+}
@@ -0,0 +1,572 @@
+/*
+ * Copyright (C) 2010-2011 Chia-I Wu <olvaffe@gmail.com>
+ * Copyright (C) 2010-2011 LunarG Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Soak test: run a randomized mix of allocations, imports, locks, fences and
+ * posts for a long time and fail when the resources or the latencies
+ * reported by GRALLOC_MODULE_PERFORM_GET_RESOURCE_STATS drift from the first
+ * interval.  With -D it runs on another device node, such as vgem.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <errno.h>
+#include <cutils/properties.h>
+
+#include "gralloc_drm_test.h"
+
+#define SOAK_MAX_BUFFERS 64
+#define SOAK_MAX_FBS 3
+
+struct soak_config {
+	int duration_s;
+	int interval_s;
+	unsigned int seed;
+	int with_fb;
+	const char *device;
+
+	/* allowed growth of the counts over the baseline */
+	uint32_t max_bos;
+	uint32_t max_fbs;
+	uint32_t max_fds;
+	/* a latency drifts when above factor times the baseline plus slack */
+	uint32_t latency_factor;
+	uint64_t latency_slack_us;
+};
+
+/* a buffer class of a realistic workload */
+struct soak_class {
+	const char *name;
+	int format;
+	int usage;
+	int max_width;
+	int max_height;
+};
+
+static const struct soak_class soak_classes[] = {
+	{ "window", HAL_PIXEL_FORMAT_RGBA_8888,
+		GRALLOC_USAGE_HW_RENDER | GRALLOC_USAGE_HW_TEXTURE |
+		GRALLOC_USAGE_HW_COMPOSER, 1920, 1080 },
+	{ "canvas", HAL_PIXEL_FORMAT_RGB_565,
+		GRALLOC_USAGE_SW_WRITE_OFTEN | GRALLOC_USAGE_HW_TEXTURE,
+		1280, 720 },
+	{ "camera", HAL_PIXEL_FORMAT_YCrCb_420_SP,
+		GRALLOC_USAGE_HW_CAMERA_WRITE | GRALLOC_USAGE_HW_TEXTURE |
+		GRALLOC_USAGE_SW_READ_OFTEN, 1920, 1080 },
+	{ "video", HAL_PIXEL_FORMAT_YV12,
+		GRALLOC_USAGE_SW_WRITE_OFTEN | GRALLOC_USAGE_HW_TEXTURE |
+		GRALLOC_USAGE_HW_VIDEO_ENCODER, 1920, 1080 },
+	{ "blob", HAL_PIXEL_FORMAT_BLOB,
+		GRALLOC_USAGE_SW_READ_OFTEN | GRALLOC_USAGE_SW_WRITE_OFTEN,
+		1 << 20, 1 },
+};
+
+struct soak_buffer {
+	buffer_handle_t handle;
+	int usage;
+	int width;
+	int height;
+	int imported;
+};
+
+struct soak {
+	struct soak_config config;
+	struct gralloc_drm_test t;
+	unsigned int seed;
+
+	struct soak_buffer buffers[SOAK_MAX_BUFFERS];
+	int count;
+	buffer_handle_t fbs[SOAK_MAX_FBS];
+	int fb_count;
+	int next_fb;
+	int no_fences;
+
+	uint64_t ops;
+	uint64_t errors;
+};
+
+static int soak_rand(struct soak *s, int n)
+{
+	return (int) (rand_r(&s->seed) % (unsigned int) n);
+}
+
+static int soak_alloc(struct soak *s)
+{
+	const struct soak_class *c;
+	struct soak_buffer *b;
+	int stride, err;
+
+	if (s->count >= SOAK_MAX_BUFFERS)
+		return 0;
+
+	c = &soak_classes[soak_rand(s, ARRAY_SIZE(soak_classes))];
+	b = &s->buffers[s->count];
+	memset(b, 0, sizeof(*b));
+	b->usage = c->usage;
+	b->width = 16 + soak_rand(s, c->max_width);
+	b->height = (c->max_height > 1) ? 16 + soak_rand(s, c->max_height) : 1;
+
+	err = s->t.alloc->alloc(s->t.alloc, b->width, b->height, c->format,
+			c->usage, &b->handle, &stride);
+	if (err) {
+		fprintf(stderr, "failed to allocate %dx%d %s: %d\n",
+				b->width, b->height, c->name, err);
+		return err;
+	}
+	s->count++;
+
+	return 0;
+}
+
+static int soak_import(struct soak *s)
+{
+	struct soak_buffer *src, *b;
+	int err;
+
+	if (!s->count || s->count >= SOAK_MAX_BUFFERS)
+		return 0;
+
+	src = &s->buffers[soak_rand(s, s->count)];
+	b = &s->buffers[s->count];
+	*b = *src;
+	b->imported = 1;
+
+	b->handle = test_clone_handle(src->handle);
+	if (!b->handle)
+		return -ENOMEM;
+
+	err = s->t.mod->registerBuffer(s->t.mod, b->handle);
+	if (err) {
+		fprintf(stderr, "failed to import a buffer: %d\n", err);
+		test_free_clone(b->handle);
+		return err;
+	}
+	s->count++;
+
+	return 0;
+}
+
+static int soak_release(struct soak *s, int i)
+{
+	struct soak_buffer *b = &s->buffers[i];
+	int err;
+
+	if (b->imported) {
+		err = s->t.mod->unregisterBuffer(s->t.mod, b->handle);
+		test_free_clone(b->handle);
+	}
+	else {
+		err = s->t.alloc->free(s->t.alloc, b->handle);
+	}
+
+	*b = s->buffers[--s->count];
+
+	return err;
+}
+
+static int soak_free(struct soak *s)
+{
+	if (!s->count)
+		return 0;
+
+	return soak_release(s, soak_rand(s, s->count));
+}
+
+static int soak_lock(struct soak *s)
+{
+	struct soak_buffer *b;
+	void *ptr;
+	int usage, err;
+
+	if (!s->count)
+		return 0;
+
+	b = &s->buffers[soak_rand(s, s->count)];
+	usage = b->usage & (GRALLOC_USAGE_SW_READ_MASK |
+			GRALLOC_USAGE_SW_WRITE_MASK);
+	if (!usage)
+		return 0;
+
+	err = s->t.mod->lock(s->t.mod, b->handle, usage, 0, 0,
+			b->width, b->height, &ptr);
+	if (err) {
+		fprintf(stderr, "failed to lock a buffer: %d\n", err);
+		return err;
+	}
+
+	if (usage & GRALLOC_USAGE_SW_WRITE_MASK)
+		memset(ptr, soak_rand(s, 256), 64);
+
+	return s->t.mod->unlock(s->t.mod, b->handle);
+}
+
+/*
+ * Attach a fence to a buffer and signal it, on devices with fences.
+ */
+static int soak_fence(struct soak *s)
+{
+	struct soak_buffer *b;
+	uint32_t fence;
+	int err;
+
+	if (!s->count || s->no_fences)
+		return 0;
+
+	b = &s->buffers[soak_rand(s, s->count)];
+	err = s->t.mod->perform(s->t.mod, GRALLOC_MODULE_PERFORM_ATTACH_FENCE,
+			b->handle, soak_rand(s, 2), &fence);
+	if (err == -ENOSYS) {
+		s->no_fences = 1;
+		return 0;
+	}
+	if (err) {
+		fprintf(stderr, "failed to attach a fence: %d\n", err);
+		return err;
+	}
+
+	return s->t.mod->perform(s->t.mod, GRALLOC_MODULE_PERFORM_SIGNAL_FENCE,
+			fence);
+}
+
+static int soak_post(struct soak *s)
+{
+	buffer_handle_t handle;
+
+	if (!s->fb_count)
+		return 0;
+
+	handle = s->fbs[s->next_fb];
+	s->next_fb = (s->next_fb + 1) % s->fb_count;
+
+	return s->t.fb->post(s->t.fb, handle);
+}
+
+static int soak_step(struct soak *s)
+{
+	int op = soak_rand(s, 100);
+
+	if (op < 25)
+		return soak_alloc(s);
+	else if (op < 45)
+		return soak_free(s);
+	else if (op < 60)
+		return soak_import(s);
+	else if (op < 80)
+		return soak_lock(s);
+	else if (op < 85)
+		return soak_fence(s);
+	else
+		return soak_post(s);
+}
+
+/*
+ * Release the whole pool, imports first so that nothing is left referring
+ * to a freed buffer.
+ */
+static void soak_drain(struct soak *s)
+{
+	int i;
+
+	for (i = s->count - 1; i >= 0; i--) {
+		if (s->buffers[i].imported && soak_release(s, i))
+			s->errors++;
+	}
+	while (s->count) {
+		if (soak_release(s, s->count - 1))
+			s->errors++;
+	}
+}
+
+static int soak_check_count(const char *name, uint64_t val, uint64_t base,
+		uint64_t slack)
+{
+	if (val <= base + slack)
+		return 0;
+
+	fprintf(stderr, "%s drifted: %llu, baseline %llu\n", name,
+			(unsigned long long) val, (unsigned long long) base);
+
+	return -1;
+}
+
+static int soak_check_latency(const struct soak_config *config,
+		const char *name, const struct gralloc_drm_histogram *hist,
+		const struct gralloc_drm_histogram *base)
+{
+	static const int percents[] = { 50, 99 };
+	int ret = 0;
+	int i;
+
+	/* nothing to compare against */
+	if (!hist->count || !base->count)
+		return 0;
+
+	for (i = 0; i < (int) ARRAY_SIZE(percents); i++) {
+		uint64_t val = gralloc_drm_histogram_percentile(hist, percents[i]);
+		uint64_t ref = gralloc_drm_histogram_percentile(base, percents[i]);
+
+		if (val > ref * config->latency_factor + config->latency_slack_us) {
+			fprintf(stderr, "%s p%d drifted: %llu us, baseline %llu us\n",
+					name, percents[i], (unsigned long long) val,
+					(unsigned long long) ref);
+			ret = -1;
+		}
+	}
+
+	return ret;
+}
+
+/*
+ * Compare a sample taken with an empty pool against the baseline.
+ */
+static int soak_check(struct soak *s,
+		const struct gralloc_drm_resource_stats *st,
+		const struct gralloc_drm_resource_stats *base)
+{
+	const struct soak_config *config = &s->config;
+	int ret = 0;
+
+	ret |= soak_check_count("local bos", st->local_bos,
+			base->local_bos, config->max_bos);
+	/* unregistered imports stay in the cache for a while */
+	ret |= soak_check_count("imported bos",
+			st->imported_bos - st->cached_bos,
+			base->imported_bos - base->cached_bos, config->max_bos);
+	ret |= soak_check_count("fbs", st->fbs, base->fbs, config->max_fbs);
+	ret |= soak_check_count("fds", st->fds, base->fds, config->max_fds);
+	ret |= soak_check_count("mapped bytes", st->mapped_bytes,
+			base->mapped_bytes, 0);
+
+	ret |= soak_check_latency(config, "alloc", &st->alloc, &base->alloc);
+	ret |= soak_check_latency(config, "import", &st->import, &base->import);
+	ret |= soak_check_latency(config, "lock", &st->lock, &base->lock);
+	ret |= soak_check_latency(config, "post", &st->post, &base->post);
+	ret |= soak_check_latency(config, "flip", &st->flip, &base->flip);
+
+	return ret;
+}
+
+static void soak_print(struct soak *s, int64_t elapsed_s,
+		const struct gralloc_drm_resource_stats *st)
+{
+	printf("%5llds ops %llu errors %llu bos %u/%u cached %u fbs %u fds %u "
+		"p50/p99 us alloc %llu/%llu import %llu/%llu lock %llu/%llu "
+		"post %llu/%llu\n",
+		(long long) elapsed_s,
+		(unsigned long long) s->ops, (unsigned long long) s->errors,
+		st->local_bos, st->imported_bos, st->cached_bos, st->fbs, st->fds,
+		(unsigned long long) gralloc_drm_histogram_percentile(&st->alloc, 50),
+		(unsigned long long) gralloc_drm_histogram_percentile(&st->alloc, 99),
+		(unsigned long long) gralloc_drm_histogram_percentile(&st->import, 50),
+		(unsigned long long) gralloc_drm_histogram_percentile(&st->import, 99),
+		(unsigned long long) gralloc_drm_histogram_percentile(&st->lock, 50),
+		(unsigned long long) gralloc_drm_histogram_percentile(&st->lock, 99),
+		(unsigned long long) gralloc_drm_histogram_percentile(&st->post, 50),
+		(unsigned long long) gralloc_drm_histogram_percentile(&st->post, 99));
+	fflush(stdout);
+}
+
+static int soak_init_fbs(struct soak *s)
+{
+	framebuffer_device_t *fb = s->t.fb;
+	int stride, err;
+
+	for (s->fb_count = 0; s->fb_count < SOAK_MAX_FBS; s->fb_count++) {
+		err = s->t.alloc->alloc(s->t.alloc, fb->width, fb->height,
+				fb->format, GRALLOC_USAGE_HW_FB |
+				GRALLOC_USAGE_HW_RENDER,
+				&s->fbs[s->fb_count], &stride);
+		if (err) {
+			fprintf(stderr, "failed to allocate a fb: %d\n", err);
+			return err;
+		}
+	}
+
+	return 0;
+}
+
+static void soak_fini_fbs(struct soak *s)
+{
+	while (s->fb_count)
+		s->t.alloc->free(s->t.alloc, s->fbs[--s->fb_count]);
+}
+
+static int soak_run(struct soak *s)
+{
+	struct gralloc_drm_resource_stats base, st;
+	int64_t start, next, now;
+	int have_base = 0, ret = 0;
+	int err;
+
+	/* start from a clean window */
+	err = s->t.mod->perform(s->t.mod,
+			GRALLOC_MODULE_PERFORM_GET_RESOURCE_STATS, &st, 1);
+	if (err) {
+		fprintf(stderr, "resource stats are not supported: %d\n", err);
+		return err;
+	}
+
+	start = test_get_time_ns();
+	next = start + (int64_t) s->config.interval_s * 1000000000;
+	while (1) {
+		if (soak_step(s))
+			s->errors++;
+		s->ops++;
+
+		now = test_get_time_ns();
+		if (now < next)
+			continue;
+
+		soak_drain(s);
+		s->t.mod->perform(s->t.mod,
+				GRALLOC_MODULE_PERFORM_GET_RESOURCE_STATS, &st, 1);
+		soak_print(s, (now - start) / 1000000000, &st);
+
+		/* the first interval is the warm-up */
+		if (!have_base) {
+			base = st;
+			have_base = 1;
+		}
+		else if (soak_check(s, &st, &base)) {
+			ret = -1;
+			break;
+		}
+
+		if (now - start >= (int64_t) s->config.duration_s * 1000000000)
+			break;
+		next = now + (int64_t) s->config.interval_s * 1000000000;
+	}
+
+	soak_drain(s);
+
+	if (s->errors) {
+		fprintf(stderr, "%llu operations failed\n",
+				(unsigned long long) s->errors);
+		ret = -1;
+	}
+
+	return ret;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -d SECONDS   duration (default 3600)\n"
+		"  -i SECONDS   sampling interval (default 60)\n"
+		"  -s SEED      random seed (default: time)\n"
+		"  -p           post to the fb device, needs DRM master\n"
+		"  -D NODE      use another device node, such as vgem\n"
+		"  -b COUNT     allowed growth of bos (default 0)\n"
+		"  -f COUNT     allowed growth of fds (default 4)\n"
+		"  -l FACTOR    allowed latency growth (default 4)\n"
+		"  -L US        latency slack in us (default 1000)\n",
+		prog);
+}
+
+int main(int argc, char **argv)
+{
+	struct soak s;
+	int opt, ret;
+
+	memset(&s, 0, sizeof(s));
+	s.config.duration_s = 3600;
+	s.config.interval_s = 60;
+	s.config.seed = (unsigned int) time(NULL);
+	s.config.max_fds = 4;
+	s.config.latency_factor = 4;
+	s.config.latency_slack_us = 1000;
+
+	while ((opt = getopt(argc, argv, "d:i:s:pD:b:f:l:L:h")) != -1) {
+		switch (opt) {
+		case 'd':
+			s.config.duration_s = atoi(optarg);
+			break;
+		case 'i':
+			s.config.interval_s = atoi(optarg);
+			break;
+		case 's':
+			s.config.seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			s.config.with_fb = 1;
+			break;
+		case 'D':
+			s.config.device = optarg;
+			break;
+		case 'b':
+			s.config.max_bos = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			s.config.max_fds = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			s.config.latency_factor = strtoul(optarg, NULL, 0);
+			break;
+		case 'L':
+			s.config.latency_slack_us = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return 2;
+		}
+	}
+
+	if (s.config.interval_s <= 0 || s.config.duration_s < s.config.interval_s) {
+		usage(argv[0]);
+		return 2;
+	}
+
+	s.seed = s.config.seed;
+	printf("seed %u\n", s.config.seed);
+
+	/* read when gralloc.drm is loaded */
+	if (s.config.device &&
+	    property_set("debug.drm.device", s.config.device)) {
+		fprintf(stderr, "failed to set debug.drm.device\n");
+		return 1;
+	}
+
+	ret = test_open(&s.t, s.config.with_fb);
+	/* do not leave the node for the compositor */
+	if (s.config.device)
+		property_set("debug.drm.device", "");
+	if (ret)
+		return 1;
+
+	ret = (s.t.fb) ? soak_init_fbs(&s) : 0;
+	if (!ret)
+		ret = soak_run(&s);
+
+	soak_fini_fbs(&s);
+	test_close(&s.t);
+
+	if (s.no_fences)
+		printf("fences are not supported\n");
+
+	printf("%s\n", (ret) ? "FAIL" : "PASS");
+
+	return (ret) ? 1 : 0;
+}
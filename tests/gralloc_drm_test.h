@@ -0,0 +1,188 @@
+/*
+ * Copyright (C) 2010-2011 Chia-I Wu <olvaffe@gmail.com>
+ * Copyright (C) 2010-2011 LunarG Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/* helpers shared by the test programs */
+
+#ifndef _GRALLOC_DRM_TEST_H_
+#define _GRALLOC_DRM_TEST_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <hardware/gralloc.h>
+
+#include "gralloc_drm.h"
+#include "gralloc_drm_handle.h"
+
+#ifndef ARRAY_SIZE
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#endif
+
+struct gralloc_drm_test {
+	const gralloc_module_t *mod;
+	alloc_device_t *alloc;
+	framebuffer_device_t *fb;
+};
+
+static inline int64_t test_get_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Load gralloc.drm and open its alloc device, and its fb device if with_fb
+ * is set.  The fb device needs DRM master, so SurfaceFlinger must be
+ * stopped.
+ */
+static inline int test_open(struct gralloc_drm_test *t, int with_fb)
+{
+	const hw_module_t *mod;
+	int err;
+
+	memset(t, 0, sizeof(*t));
+
+	err = hw_get_module_by_class(GRALLOC_HARDWARE_MODULE_ID, "drm", &mod);
+	if (err) {
+		fprintf(stderr, "failed to load gralloc.drm: %d\n", err);
+		return err;
+	}
+	t->mod = (const gralloc_module_t *) mod;
+
+	err = mod->methods->open(mod, GRALLOC_HARDWARE_GPU0,
+			(hw_device_t **) &t->alloc);
+	if (err) {
+		fprintf(stderr, "failed to open the alloc device: %d\n", err);
+		return err;
+	}
+
+	if (with_fb) {
+		err = mod->methods->open(mod, GRALLOC_HARDWARE_FB0,
+				(hw_device_t **) &t->fb);
+		if (err) {
+			fprintf(stderr, "failed to open the fb device: %d\n", err);
+			t->alloc->common.close(&t->alloc->common);
+			t->alloc = NULL;
+			return err;
+		}
+	}
+
+	return 0;
+}
+
+static inline void test_close(struct gralloc_drm_test *t)
+{
+	if (t->fb)
+		t->fb->common.close(&t->fb->common);
+	if (t->alloc)
+		t->alloc->common.close(&t->alloc->common);
+	memset(t, 0, sizeof(*t));
+}
+
+/*
+ * Copy a handle the way binder delivers it to another process: the fds are
+ * duplicated and the process-local fields are cleared, so registering the
+ * copy goes through the import path.
+ */
+static inline buffer_handle_t test_clone_handle(buffer_handle_t _handle)
+{
+	struct gralloc_drm_handle_t *handle = gralloc_drm_handle(_handle);
+	struct gralloc_drm_handle_t *clone;
+
+	if (!handle)
+		return NULL;
+
+	clone = malloc(sizeof(*clone));
+	if (!clone)
+		return NULL;
+
+	memcpy(clone, handle, sizeof(*clone));
+	clone->shared_fd = dup(handle->shared_fd);
+	if (clone->shared_fd < 0) {
+		free(clone);
+		return NULL;
+	}
+	clone->data_owner = 0;
+	clone->data = NULL;
+
+	return &clone->base;
+}
+
+static inline void test_free_clone(buffer_handle_t _handle)
+{
+	struct gralloc_drm_handle_t *clone =
+		(struct gralloc_drm_handle_t *) _handle;
+
+	close(clone->shared_fd);
+	free(clone);
+}
+
+/*
+ * Run fn in a new process and copy the size bytes it leaves in res back to
+ * this one.  Settings that are read when gralloc.drm is loaded need a
+ * process each.
+ */
+static inline int test_run_forked(void (*fn)(void *data, void *res),
+		void *data, void *res, size_t size)
+{
+	int fds[2], status;
+	pid_t pid;
+	ssize_t len;
+
+	if (pipe(fds))
+		return -errno;
+
+	pid = fork();
+	if (pid < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		return -errno;
+	}
+
+	if (!pid) {
+		close(fds[0]);
+		fn(data, res);
+		len = write(fds[1], res, size);
+		_exit((len == (ssize_t) size) ? 0 : 1);
+	}
+
+	close(fds[1]);
+	len = read(fds[0], res, size);
+	close(fds[0]);
+	waitpid(pid, &status, 0);
+
+	if (len != (ssize_t) size || !WIFEXITED(status) ||
+	    WEXITSTATUS(status))
+		return -EIO;
+
+	return 0;
+}
+
+#endif /* _GRALLOC_DRM_TEST_H_ */